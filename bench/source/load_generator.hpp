@@ -0,0 +1,285 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit::bench
+{
+// Keep-alive connections that each write a request as soon as the response to their last one
+// has been read, for as long as a run lasts. Requests are serialized up front and responses
+// are only framed by their Content-Length, so once running the client allocates nothing per
+// request but the room to record its latency
+class load_generator
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct result
+    {
+        // Responses read while measuring, and in all, warming up included
+        uint64_t requests = 0;
+        uint64_t total_requests = 0;
+
+        // Failed connections, and responses without a 2xx status
+        uint64_t errors = 0;
+
+        // From the start of measuring to the last response read
+        clock::duration elapsed {};
+
+        // Nanoseconds from a request being written to its response being read, fastest first
+        std::vector<int64_t> latencies;
+
+        // The latency `fraction` of the requests were faster than, e.g. 0.99 for the p99
+        [[nodiscard]] auto percentile(double fraction) const -> int64_t
+        {
+            if (latencies.empty())
+            {
+                return 0;
+            }
+
+            const auto index = static_cast<size_t>(fraction * static_cast<double>(latencies.size()));
+            return latencies[std::min(index, latencies.size() - 1)];
+        }
+
+        [[nodiscard]] auto per_second() const -> double
+        {
+            const auto seconds = std::chrono::duration<double>(elapsed).count();
+            return seconds > 0 ? static_cast<double>(requests) / seconds : 0;
+        }
+    };
+
+  private:
+    // The whole length of the response at the start of `data`, or 0 if it hasn't all been read yet
+    static auto response_length(std::string_view data) -> size_t
+    {
+        const auto header_end = data.find("\r\n\r\n");
+        if (header_end == std::string_view::npos)
+        {
+            return 0;
+        }
+
+        auto header = data.substr(0, header_end);
+        uint64_t content_length = 0;
+        while (not header.empty())
+        {
+            const auto line = header.substr(0, header.find("\r\n"));
+            header.remove_prefix(std::min(line.size() + 2, header.size()));
+
+            const auto colon = line.find(':');
+            if (colon != std::string_view::npos && beast::iequals(line.substr(0, colon), "content-length"))
+            {
+                auto value = line.substr(colon + 1);
+                value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+                std::from_chars(value.data(), value.data() + value.size(), content_length);
+            }
+        }
+
+        const auto length = header_end + 4 + static_cast<size_t>(content_length);
+        return data.size() >= length ? length : 0;
+    }
+
+    // How long a run lasts, shared by its connections
+    struct schedule
+    {
+        clock::time_point measure_from;
+        clock::time_point stop_at;
+    };
+
+    class connection
+    {
+        static constexpr size_t read_size = 64 * 1024;
+
+        tcp::socket m_socket;
+        std::span<const std::string> m_requests;
+        size_t m_next;
+        const schedule& m_schedule;
+
+        beast::flat_buffer m_buffer;
+        clock::time_point m_sent {};
+
+      public:
+        std::vector<int64_t> latencies;
+        uint64_t requests = 0;
+        uint64_t total_requests = 0;
+        uint64_t errors = 0;
+        clock::time_point last {};
+
+        connection(net::io_context& ioc, std::span<const std::string> requests, size_t first, const schedule& times)
+            : m_socket(ioc)
+            , m_requests(requests)
+            , m_next(first)
+            , m_schedule(times)
+        {
+        }
+
+        void connect(const tcp::endpoint& endpoint)
+        {
+            m_socket.connect(endpoint);
+            m_socket.set_option(tcp::no_delay(true));
+        }
+
+        void send()
+        {
+            m_sent = clock::now();
+            net::async_write(m_socket,
+                             net::buffer(m_requests[m_next++ % m_requests.size()]),
+                             [this](beast::error_code err, size_t /*bytes*/)
+                             {
+                                 if (err)
+                                 {
+                                     return fail();
+                                 }
+                                 read();
+                             });
+        }
+
+        void read()
+        {
+            m_socket.async_read_some(m_buffer.prepare(read_size),
+                                     [this](beast::error_code err, size_t bytes) { on_read(err, bytes); });
+        }
+
+        void on_read(beast::error_code err, size_t bytes)
+        {
+            if (err)
+            {
+                return fail();
+            }
+
+            m_buffer.commit(bytes);
+            const std::string_view data {static_cast<const char*>(m_buffer.data().data()), m_buffer.size()};
+            const auto length = response_length(data);
+            if (length == 0)
+            {
+                return read();
+            }
+
+            // after "HTTP/1.1 "
+            constexpr size_t status_offset = 9;
+            if (data.size() <= status_offset || data[status_offset] != '2')
+            {
+                errors++;
+            }
+            m_buffer.consume(length);
+
+            const auto now = clock::now();
+            total_requests++;
+            if (now >= m_schedule.measure_from)
+            {
+                requests++;
+                latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_sent).count());
+                last = now;
+            }
+
+            if (now >= m_schedule.stop_at)
+            {
+                return close();
+            }
+
+            send();
+        }
+
+        void fail()
+        {
+            errors++;
+            close();
+        }
+
+        void close()
+        {
+            beast::error_code err;
+            m_socket.close(err);
+        }
+    };
+
+    tcp::endpoint m_endpoint;
+    std::vector<std::string> m_requests;
+    size_t m_connections;
+    size_t m_threads;
+
+    // Set on the threads in `run`, so that what they do can be told apart from what the server does
+    static inline thread_local bool t_generating = false;
+
+  public:
+    // `connections` connections to `endpoint`, run by `threads` threads, each writing
+    // `requests` in turn from a different one
+    load_generator(tcp::endpoint endpoint, std::vector<std::string> requests, size_t connections, size_t threads)
+        : m_endpoint(std::move(endpoint))
+        , m_requests(std::move(requests))
+        , m_connections(std::max<size_t>(connections, 1))
+        , m_threads(std::max<size_t>(threads, 1))
+    {
+    }
+
+    // Connect, then load the server for `warmup` before measuring for `duration`
+    auto run(clock::duration warmup, clock::duration duration) -> result
+    {
+        t_generating = true;
+
+        net::io_context ioc {static_cast<int>(m_threads)};
+        schedule times {};
+
+        std::vector<std::unique_ptr<connection>> connections;
+        connections.reserve(m_connections);
+        for (size_t i = 0; i < m_connections; i++)
+        {
+            connections.push_back(std::make_unique<connection>(ioc, m_requests, i, times));
+            connections.back()->connect(m_endpoint);
+        }
+
+        times.measure_from = clock::now() + warmup;
+        times.stop_at = times.measure_from + duration;
+        for (auto& conn : connections)
+        {
+            conn->send();
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(m_threads - 1);
+        for (size_t i = 1; i < m_threads; i++)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    t_generating = true;
+                    ioc.run();
+                });
+        }
+        ioc.run();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        result out;
+        auto last = times.measure_from;
+        for (auto& conn : connections)
+        {
+            out.requests += conn->requests;
+            out.total_requests += conn->total_requests;
+            out.errors += conn->errors;
+            out.latencies.insert(out.latencies.end(), conn->latencies.begin(), conn->latencies.end());
+            last = std::max(last, conn->last);
+        }
+
+        out.elapsed = last - times.measure_from;
+        std::sort(out.latencies.begin(), out.latencies.end());
+
+        t_generating = false;
+        return out;
+    }
+
+    // Whether the calling thread is one that `run` is loading the server from
+    static auto is_generating() -> bool { return t_generating; }
+};
+}  // namespace mech_suit::bench
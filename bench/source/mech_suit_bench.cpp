@@ -0,0 +1,227 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "mech_suit/mech_suit.hpp"
+
+namespace ms = mech_suit;
+
+namespace
+{
+using ms::http::verb;
+
+auto respond(const ms::http_request& request) -> ms::http::message_generator
+{
+    return ms::http::response<ms::http::empty_body> {ms::http::status::ok, request.beast_request.version()};
+}
+
+// A synthetic table with alternating explicit and dynamic routes.
+// Each route has its own path, but only two route types are instantiated
+class route_table
+{
+    ms::detail::router m_router;
+
+  public:
+    explicit route_table(size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            if (i % 2 == 0)
+            {
+                m_router.add_route_at<"/static/0/items", verb::get>(
+                    "/static/" + std::to_string(i) + "/items",
+                    [](const ms::http_request& request) { return respond(request); });
+            }
+            else
+            {
+                m_router.add_route_at<"/dynamic/0/:int(id)", verb::get>(
+                    "/dynamic/" + std::to_string(i) + "/:int(id)",
+                    [](const ms::http_request& request, int) { return respond(request); });
+            }
+        }
+    }
+
+    auto router() const -> const ms::detail::router& { return m_router; }
+};
+
+// Requests spread over every route of a table, `hit_percent` of which match
+auto make_requests(size_t table_size, int64_t hit_percent) -> std::vector<ms::http_request>
+{
+    constexpr size_t count = 1024;
+
+    std::vector<ms::http_request> requests;
+    requests.reserve(count);
+
+    std::mt19937 rng {count};
+    for (size_t i = 0; i < count; i++)
+    {
+        const auto route = rng() % table_size;
+        const bool hit = static_cast<int64_t>(rng() % 100) < hit_percent;
+
+        auto target = route % 2 == 0 ? "/static/" + std::to_string(route) + (hit ? "/items" : "/missing")
+                                     : "/dynamic/" + std::to_string(route) + (hit ? "/42" : "/not-a-number");
+
+        requests.emplace_back(ms::http_request::beast_request_t {verb::get, target, 11});
+    }
+
+    return requests;
+}
+
+void bm_router_handle_request(benchmark::State& state)
+{
+    const auto table_size = static_cast<size_t>(state.range(0));
+    const auto hit_percent = state.range(1);
+
+    const route_table table {table_size};
+    const auto requests = make_requests(table_size, hit_percent);
+
+    size_t idx = 0;
+    for (auto _ : state)
+    {
+        auto response = table.router().handle_request(requests[idx++ % requests.size()]);
+        benchmark::DoNotOptimize(response);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_router_handle_request)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {100, 90, 50, 0}})
+    ->ArgNames({"routes", "hit_percent"});
+
+using static_api = ms::routes<
+    ms::static_route<verb::get, "/static/0/items", [](const ms::http_request& request) { return respond(request); }>,
+    ms::static_route<verb::get, "/static/2/items", [](const ms::http_request& request) { return respond(request); }>,
+    ms::static_route<verb::get,
+                     "/dynamic/1/:int(id)",
+                     [](const ms::http_request& request, int) { return respond(request); }>,
+    ms::static_route<verb::get,
+                     "/dynamic/3/:int(id)",
+                     [](const ms::http_request& request, int) { return respond(request); }>>;
+
+// The same four routes as a `route_table` of 4, dispatched by the compile time router
+void bm_static_router_handle_request(benchmark::State& state)
+{
+    const ms::detail::static_router<static_api> router;
+    const auto requests = make_requests(4, state.range(0));
+
+    size_t idx = 0;
+    for (auto _ : state)
+    {
+        auto response = router.handle_request(requests[idx++ % requests.size()]);
+        benchmark::DoNotOptimize(response);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_static_router_handle_request)->Arg(100)->Arg(50)->Arg(0)->ArgName("hit_percent");
+
+void bm_dynamic_router_4_routes(benchmark::State& state)
+{
+    const route_table table {4};
+    const auto requests = make_requests(4, state.range(0));
+
+    size_t idx = 0;
+    for (auto _ : state)
+    {
+        auto response = table.router().handle_request(requests[idx++ % requests.size()]);
+        benchmark::DoNotOptimize(response);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_dynamic_router_4_routes)->Arg(100)->Arg(50)->Arg(0)->ArgName("hit_percent");
+
+void bm_http_params(benchmark::State& state)
+{
+    using params_t = ms::detail::http_params<"/users/:int(id)/posts/:long(post)/:string(slug)/:bool(draft)">;
+
+    std::array<std::string_view, 6> parts {"users", "1234", "posts", "567890", "hello-world", "true"};
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(parts);
+        params_t params {parts};
+        benchmark::DoNotOptimize(params.params);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_http_params);
+
+// Includes copying the beast request, which stands in for the one the parser produces
+void bm_http_request(benchmark::State& state)
+{
+    ms::http_request::beast_request_t prototype {verb::get, "/users/1234/posts/567890/?sort=asc&page=2", 11};
+    prototype.set(ms::http::field::host, "localhost");
+    prototype.set(ms::http::field::user_agent, "mech_suit_bench");
+    prototype.set(ms::http::field::accept, "*/*");
+
+    for (auto _ : state)
+    {
+        ms::http_request request {ms::http_request::beast_request_t {prototype}};
+        benchmark::DoNotOptimize(request.path);
+        benchmark::DoNotOptimize(request.query);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_http_request);
+// A request at a time through a session's parser, router and serializer, over a stream in memory
+void bm_session_memory_stream(benchmark::State& state)
+{
+    ms::net::io_context ioc {1};
+
+    auto router = std::make_shared<ms::detail::router>();
+    router->add_route<"/users/:int(id)", verb::get>(
+        [](const ms::http_request& request, int) -> ms::http::message_generator
+        {
+            ms::http::response<ms::http::empty_body> response {ms::http::status::ok, request.beast_request.version()};
+            response.keep_alive(request.beast_request.keep_alive());
+            response.prepare_payload();
+            return response;
+        });
+
+    auto [client, server] = ms::memory_stream::pair(ioc.get_executor());
+    std::make_shared<ms::detail::http_session<ms::detail::router, ms::memory_stream>>(
+        std::make_shared<ms::config>(), std::move(server), router, [](ms::beast::error_code) {})
+        ->run();
+
+    const std::string request = "GET /users/42 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string response;
+
+    for (auto _ : state)
+    {
+        bool done = false;
+        ms::net::async_write(client, ms::net::buffer(request), [](ms::beast::error_code, size_t) {});
+        ms::net::async_read_until(client,
+                                  ms::net::dynamic_buffer(response),
+                                  "\r\n\r\n",
+                                  [&](ms::beast::error_code, size_t) { done = true; });
+        while (not done)
+        {
+            ioc.run_one();
+        }
+
+        benchmark::DoNotOptimize(response.data());
+        response.clear();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(bm_session_memory_stream);
+}  // namespace
+
+BENCHMARK_MAIN();
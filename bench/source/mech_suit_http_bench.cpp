@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "load_generator.hpp"
+#include "mech_suit/mech_suit.hpp"
+
+namespace ms = mech_suit;
+
+// Outside the anonymous namespace, as the routes that take and return it are instantiated in headers
+struct user
+{
+    int id = 0;
+    std::string name;
+};
+
+namespace
+{
+// Every allocation of the server's threads, as the load generator's would make the server look worse.
+// A counter per thread, so that counting doesn't make them wait on each other
+struct alignas(64) allocation_counter
+{
+    std::atomic<uint64_t> count {0};
+};
+
+constexpr size_t counter_count = 64;
+std::array<allocation_counter, counter_count> g_allocations {};
+std::atomic<size_t> g_next_counter {0};
+
+void count_allocation()
+{
+    if (ms::bench::load_generator::is_generating())
+    {
+        return;
+    }
+
+    thread_local const size_t counter = g_next_counter.fetch_add(1, std::memory_order_relaxed) % counter_count;
+    g_allocations[counter].count.fetch_add(1, std::memory_order_relaxed);
+}
+
+auto allocations() -> uint64_t
+{
+    uint64_t total = 0;
+    for (const auto& counter : g_allocations)
+    {
+        total += counter.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+}  // namespace
+
+auto operator new(size_t size) -> void*
+{
+    count_allocation();
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+auto operator new(size_t size, std::align_val_t align) -> void*
+{
+    count_allocation();
+    const auto alignment = static_cast<size_t>(align);
+    if (void* ptr = std::aligned_alloc(alignment, ((std::max<size_t>(size, 1) + alignment - 1) / alignment) * alignment))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t /*size*/) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t /*align*/) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t /*size*/, std::align_val_t /*align*/) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+using namespace std::chrono_literals;
+
+constexpr auto warmup = 500ms;
+constexpr auto duration = 2s;
+
+// An application on loopback with an explicit, a parameterized and a JSON body route.
+// Half the cores serve, the other half are left to the load generator
+class server
+{
+    static constexpr uint16_t port = 3190;
+
+    ms::application<> m_app;
+    std::thread m_thread;
+
+    static auto make_config() -> ms::config
+    {
+        return {.address = "127.0.0.1", .port = port, .num_threads = server_threads()};
+    }
+
+    void wait_until_listening() const
+    {
+        constexpr auto give_up_after = 5s;
+
+        const auto until = std::chrono::steady_clock::now() + give_up_after;
+        while (std::chrono::steady_clock::now() < until)
+        {
+            ms::net::io_context ioc;
+            ms::tcp::socket socket {ioc};
+            ms::beast::error_code err;
+            socket.connect(endpoint(), err);
+            if (not err)
+            {
+                return;
+            }
+            std::this_thread::sleep_for(10ms);
+        }
+
+        throw std::runtime_error("The server didn't start listening on port " + std::to_string(port));
+    }
+
+  public:
+    server()
+        : m_app(make_config())
+    {
+        m_app.get<"/plaintext">(
+            [](const ms::http_request& request) -> ms::http::message_generator
+            {
+                ms::http::response<ms::http::string_body> response {ms::http::status::ok,
+                                                                    request.beast_request.version()};
+                response.set(ms::http::field::content_type, "text/plain");
+                response.keep_alive(request.beast_request.keep_alive());
+                response.body() = "Hello, World!";
+                response.prepare_payload();
+                return response;
+            });
+
+        m_app.get<"/users/:int(id)">([](const ms::http_request& /*request*/, int id) { return user {id, "mech"}; });
+
+        m_app.post<"/users", ms::body_json<user>>(
+            [](const ms::http_request& /*request*/, const user& body)
+            { return ms::json_response<user> {body, ms::http::status::created}; });
+
+        m_thread = std::thread([this] { m_app.run(); });
+        wait_until_listening();
+    }
+
+    server(const server&) = delete;
+    server(server&&) = delete;
+    auto operator=(const server&) -> server& = delete;
+    auto operator=(server&&) -> server& = delete;
+
+    ~server()
+    {
+        m_app.stop();
+        m_thread.join();
+    }
+
+    static auto instance() -> server&
+    {
+        static server running;
+        return running;
+    }
+
+    static auto server_threads() -> size_t { return std::max<size_t>(std::thread::hardware_concurrency() / 2, 1); }
+
+    static auto client_threads() -> size_t
+    {
+        return std::max<size_t>(std::thread::hardware_concurrency() - server_threads(), 1);
+    }
+
+    static auto endpoint() -> ms::tcp::endpoint { return {ms::net::ip::make_address("127.0.0.1"), port}; }
+};
+
+enum class route
+{
+    explicit_path,
+    path_param,
+    json_body,
+};
+
+// What the connections write in turn for `which` route
+auto requests_for(route which) -> std::vector<std::string>
+{
+    constexpr size_t variants = 16;
+
+    std::vector<std::string> requests;
+    for (size_t i = 0; i < variants; i++)
+    {
+        switch (which)
+        {
+            case route::explicit_path:
+                requests.emplace_back("GET /plaintext HTTP/1.1\r\nHost: localhost\r\n\r\n");
+                break;
+            case route::path_param:
+                requests.push_back("GET /users/" + std::to_string(i * 7919) + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+                break;
+            case route::json_body:
+            {
+                const auto body = R"({"id":)" + std::to_string(i) + R"(,"name":"user )" + std::to_string(i) + R"("})";
+                requests.push_back("POST /users HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n"
+                                   "Content-Length: "
+                                   + std::to_string(body.size()) + "\r\n\r\n" + body);
+                break;
+            }
+        }
+    }
+    return requests;
+}
+
+// A run of the load generator per benchmark, timed by it rather than by the iteration.
+// Its counters, with the rest of the results, are written as JSON by `--benchmark_format=json`
+void bm_http_keep_alive(benchmark::State& state, route which)
+{
+    auto& target = server::instance();
+    ms::bench::load_generator load {
+        target.endpoint(), requests_for(which), static_cast<size_t>(state.range(0)), server::client_threads()};
+
+    for (auto _ : state)
+    {
+        const auto allocated_before = allocations();
+        const auto result = load.run(warmup, duration);
+        const auto allocated = allocations() - allocated_before;
+
+        state.SetIterationTime(std::chrono::duration<double>(result.elapsed).count());
+        state.SetItemsProcessed(static_cast<int64_t>(result.requests));
+
+        constexpr double nanos_per_micro = 1000;
+        state.counters["req_per_s"] = result.per_second();
+        state.counters["p50_us"] = static_cast<double>(result.percentile(0.5)) / nanos_per_micro;
+        state.counters["p99_us"] = static_cast<double>(result.percentile(0.99)) / nanos_per_micro;
+        state.counters["p999_us"] = static_cast<double>(result.percentile(0.999)) / nanos_per_micro;
+        state.counters["allocs_per_req"] =
+            result.total_requests == 0 ? 0 : static_cast<double>(allocated) / static_cast<double>(result.total_requests);
+        state.counters["errors"] = static_cast<double>(result.errors);
+    }
+}
+
+BENCHMARK_CAPTURE(bm_http_keep_alive, explicit_path, route::explicit_path)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->ArgName("connections")
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_CAPTURE(bm_http_keep_alive, path_param, route::path_param)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->ArgName("connections")
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_CAPTURE(bm_http_keep_alive, json_body, route::json_body)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(64)
+    ->ArgName("connections")
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -70,6 +70,22 @@ auto main() -> int
             return response;
         });
 
+    // a coroutine handler frees its thread for other connections while it waits
+    app.get<"/wait/:int(ms)">(
+        [](const ms::http_request& request, int ms) -> ms::net::awaitable<ms::http::message_generator>
+        {
+            ms::net::steady_timer timer {co_await ms::net::this_coro::executor, std::chrono::milliseconds(ms)};
+            co_await timer.async_wait(ms::net::use_awaitable);
+
+            ms::http::response<ms::http::string_body> response {ms::http::status::ok,
+                                                                request.beast_request.version()};
+            response.set(ms::http::field::content_type, "text/html");
+            response.keep_alive(request.beast_request.keep_alive());
+            response.body() = std::format("Waited {}ms\n", ms);
+            response.prepare_payload();
+            co_return response;
+        });
+
     app.post<"/", ms::body_json<foo>>(
         [](ms::http_request const& request, foo const& body)
         {
@@ -82,6 +98,9 @@ auto main() -> int
             return response;
         });
 
+    // a value returned instead of a response is written as JSON
+    app.get<"/foo/:int(bar)">([](ms::http_request const& /*request*/, int bar) { return foo {.bar = bar}; });
+
     app.stop_on_signals(SIGTERM, SIGINT);
 
     std::cout << std::format("Running basic_example on {}:{}\n", conf.address, conf.port);
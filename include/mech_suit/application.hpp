@@ -1,35 +1,117 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <boost/asio/signal_set.hpp>
 
 #include "mech_suit/body.hpp"
 #include "mech_suit/config.hpp"
+#include "mech_suit/connection_limit.hpp"
 #include "mech_suit/error_handlers.hpp"
 #include "mech_suit/listener.hpp"
 #include "mech_suit/meta_string.hpp"
+#include "mech_suit/offload.hpp"
+#include "mech_suit/response.hpp"
+#include "mech_suit/response_cache.hpp"
+#include "mech_suit/route_options.hpp"
 #include "mech_suit/route.hpp"
 #include "mech_suit/router.hpp"
+#include "mech_suit/static_router.hpp"
 
 namespace mech_suit
 {
+namespace detail
+{
+template<typename Routes>
+struct router_for : std::type_identity<static_router<Routes>>
+{
+};
+
+template<>
+struct router_for<dynamic_routes> : std::type_identity<router>
+{
+};
+
+// Keep the calling thread on the `index`th of the cores it may run on.
+// Best effort, as the thread still works anywhere
+inline void pin_to_core(size_t index)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+    {
+        return;
+    }
+
+    index %= static_cast<size_t>(CPU_COUNT(&allowed));
+    for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+        {
+            cpu_set_t core;
+            CPU_ZERO(&core);
+            CPU_SET(cpu, &core);
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(core), &core);
+            return;
+        }
+    }
+#else
+    boost::ignore_unused(index);
+#endif
+}
+}  // namespace detail
+
+// `Routes` is either `dynamic_routes`, to add routes at runtime with `add_route`,
+// or a compile time `routes<static_route<...>...>` list
+template<typename Routes = dynamic_routes>
 class application
 {
+    using router_t = typename detail::router_for<Routes>::type;
+
+    static constexpr bool has_dynamic_routes = std::is_same_v<Routes, dynamic_routes>;
+
   public:
   private:
-    std::shared_ptr<detail::router> m_router = std::make_shared<detail::router>();
+    std::shared_ptr<router_t> m_router = std::make_shared<router_t>();
     std::vector<std::thread> m_threads {};
     std::shared_ptr<config> m_config;
-    net::io_context m_ioc;
+
+    // One shared by every thread, or one per thread with `config::thread_per_core`
+    std::vector<std::unique_ptr<net::io_context>> m_iocs;
     std::unique_ptr<net::signal_set> m_signals;
     socket_error_handler_t m_socket_error_handler = [](auto){};
 
+    // Shared by the listeners, so the limit holds across every thread
+    std::shared_ptr<detail::connection_limit> m_connections;
+
   public:
     explicit application(config conf = {})
         : m_config(std::make_shared<config>(conf))
-        , m_ioc(static_cast<int>(m_config->num_threads))
+        , m_connections(std::make_shared<detail::connection_limit>(m_config->max_connections))
     {
+        if (not m_config->thread_per_core)
+        {
+            m_iocs.push_back(std::make_unique<net::io_context>(static_cast<int>(m_config->num_threads)));
+            return;
+        }
+
+        // a hint of 1 tells each `io_context` that one thread runs it, so the handlers that thread
+        // posts go on its private queue rather than through the shared one. It still locks, since
+        // offloaded work and `stop()` post to it from other threads
+        for (size_t i = 0; i < std::max<size_t>(m_config->num_threads, 1); i++)
+        {
+            m_iocs.push_back(std::make_unique<net::io_context>(1));
+        }
     }
 
     application(const application&) = delete;
@@ -40,52 +122,332 @@ class application
     ~application() { stop(); }
 
     template<http::verb Method, meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void add_route(detail::callback_type_t<Path, Method, Body> callback)
     {
-        m_router->add_route<Path, Method, Body>(callback);
+        m_router->template add_route<Path, Method, Body>(callback);
+    }
+
+    // The callback runs on `pool` rather than an I/O thread, for routes that do CPU heavy work.
+    // `pool` has to outlive the application
+    template<http::verb Method, meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void add_route(detail::callback_type_t<Path, Method, Body> callback, net::thread_pool& pool)
+    {
+        m_router->template add_route<Path, Method, Body>(callback, pool);
+    }
+
+    // Responses are kept for `options.ttl`, per path and query, and written to
+    // later requests without calling the callback. Only for GET routes
+    template<http::verb Method, meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void add_route(detail::callback_type_t<Path, Method, Body> callback, cache_options options)
+    {
+        m_router->template add_route<Path, Method, Body>(callback, options);
+    }
+
+    // Responses are cached or compressed as set in `options`, e.g.
+    // `{.compression = compression_options {.min_size = 4096}}`. A compressed route
+    // returns a response or a value, which is compressed before it is serialized
+    template<http::verb Method, meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && (std::is_convertible_v<Callback, detail::callback_type_t<Path, Method, Body>>
+                     || detail::route_impl<Path, Method, Body>::template is_typed_callback<Callback>))
+    void add_route(Callback callback, route_options options)
+    {
+        m_router->template add_route<Path, Method, Body>(std::move(callback), std::move(options));
+    }
+
+    // The callback is a coroutine, which the connection awaits without blocking its thread
+    template<http::verb Method, meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void add_route(detail::async_callback_type_t<Path, Method, Body> callback)
+    {
+        m_router->template add_route<Path, Method, Body>(callback);
+    }
+
+    // The callback returns a value rather than a response, which is written as JSON, or as
+    // glaze binary if the request would rather accept that. Return a `glz_any_response`
+    // to choose the status as well, or a `json_response` or `binary_response` to fix the format
+    template<http::verb Method, meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes && detail::route_impl<Path, Method, Body>::template is_typed_callback<Callback>)
+    void add_route(Callback callback)
+    {
+        m_router->template add_route<Path, Method, Body>(std::move(callback));
     }
 
     template<meta::string Path>
+        requires(has_dynamic_routes)
     void get(detail::callback_type_t<Path, http::verb::get> callback)
     {
         add_route<http::verb::get, Path>(callback);
     }
 
+    template<meta::string Path>
+        requires(has_dynamic_routes)
+    void get(detail::callback_type_t<Path, http::verb::get> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::get, Path>(callback, pool);
+    }
+
+    template<meta::string Path>
+        requires(has_dynamic_routes)
+    void get(detail::callback_type_t<Path, http::verb::get> callback, cache_options options)
+    {
+        add_route<http::verb::get, Path>(callback, options);
+    }
+
+    template<meta::string Path>
+        requires(has_dynamic_routes)
+    void get(detail::callback_type_t<Path, http::verb::get> callback, route_options options)
+    {
+        add_route<http::verb::get, Path>(callback, std::move(options));
+    }
+
+    template<meta::string Path>
+        requires(has_dynamic_routes)
+    void get(detail::async_callback_type_t<Path, http::verb::get> callback)
+    {
+        add_route<http::verb::get, Path>(callback);
+    }
+
+    template<meta::string Path, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::get, no_body_t>::template is_typed_callback<Callback>)
+    void get(Callback callback)
+    {
+        add_route<http::verb::get, Path>(std::move(callback));
+    }
+
     template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void head(detail::callback_type_t<Path, http::verb::head, Body> callback)
     {
         add_route<http::verb::head, Path, Body>(callback);
     }
 
     template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void head(detail::callback_type_t<Path, http::verb::head, Body> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::head, Path, Body>(callback, pool);
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void head(detail::async_callback_type_t<Path, http::verb::head, Body> callback)
+    {
+        add_route<http::verb::head, Path, Body>(callback);
+    }
+
+    template<meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::head, Body>::template is_typed_callback<Callback>)
+    void head(Callback callback)
+    {
+        add_route<http::verb::head, Path, Body>(std::move(callback));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void post(detail::callback_type_t<Path, http::verb::post, Body> callback)
     {
         add_route<http::verb::post, Path, Body>(callback);
     }
 
     template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void post(detail::callback_type_t<Path, http::verb::post, Body> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::post, Path, Body>(callback, pool);
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void post(detail::callback_type_t<Path, http::verb::post, Body> callback, route_options options)
+    {
+        add_route<http::verb::post, Path, Body>(callback, std::move(options));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void post(detail::async_callback_type_t<Path, http::verb::post, Body> callback)
+    {
+        add_route<http::verb::post, Path, Body>(callback);
+    }
+
+    template<meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::post, Body>::template is_typed_callback<Callback>)
+    void post(Callback callback)
+    {
+        add_route<http::verb::post, Path, Body>(std::move(callback));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void put(detail::callback_type_t<Path, http::verb::put, Body> callback)
     {
         add_route<http::verb::put, Path, Body>(callback);
     }
 
     template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void put(detail::callback_type_t<Path, http::verb::put, Body> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::put, Path, Body>(callback, pool);
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void put(detail::callback_type_t<Path, http::verb::put, Body> callback, route_options options)
+    {
+        add_route<http::verb::put, Path, Body>(callback, std::move(options));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void put(detail::async_callback_type_t<Path, http::verb::put, Body> callback)
+    {
+        add_route<http::verb::put, Path, Body>(callback);
+    }
+
+    template<meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::put, Body>::template is_typed_callback<Callback>)
+    void put(Callback callback)
+    {
+        add_route<http::verb::put, Path, Body>(std::move(callback));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void delete_(detail::callback_type_t<Path, http::verb::delete_, Body> callback)
     {
         add_route<http::verb::delete_, Path, Body>(callback);
     }
 
     template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void delete_(detail::callback_type_t<Path, http::verb::delete_, Body> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::delete_, Path, Body>(callback, pool);
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void delete_(detail::callback_type_t<Path, http::verb::delete_, Body> callback, route_options options)
+    {
+        add_route<http::verb::delete_, Path, Body>(callback, std::move(options));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void delete_(detail::async_callback_type_t<Path, http::verb::delete_, Body> callback)
+    {
+        add_route<http::verb::delete_, Path, Body>(callback);
+    }
+
+    template<meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::delete_, Body>::template is_typed_callback<Callback>)
+    void delete_(Callback callback)
+    {
+        add_route<http::verb::delete_, Path, Body>(std::move(callback));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
     void options(detail::callback_type_t<Path, http::verb::options, Body> callback)
     {
         add_route<http::verb::options, Path, Body>(callback);
     }
 
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void options(detail::callback_type_t<Path, http::verb::options, Body> callback, net::thread_pool& pool)
+    {
+        add_route<http::verb::options, Path, Body>(callback, pool);
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void options(detail::callback_type_t<Path, http::verb::options, Body> callback, route_options options)
+    {
+        add_route<http::verb::options, Path, Body>(callback, std::move(options));
+    }
+
+    template<meta::string Path, typename Body = no_body_t>
+        requires(has_dynamic_routes)
+    void options(detail::async_callback_type_t<Path, http::verb::options, Body> callback)
+    {
+        add_route<http::verb::options, Path, Body>(callback);
+    }
+
+    template<meta::string Path, typename Body = no_body_t, typename Callback>
+        requires(has_dynamic_routes
+                 && detail::route_impl<Path, http::verb::options, Body>::template is_typed_callback<Callback>)
+    void options(Callback callback)
+    {
+        add_route<http::verb::options, Path, Body>(std::move(callback));
+    }
+
+    // Serve the files under `root` at `Prefix`, e.g. `static_files<"/assets">("public")`
+    // serves "public/app.js" at "/assets/app.js". Routes are matched first
+    template<meta::string Prefix>
+    void static_files(const std::filesystem::path& root)
+    {
+        constexpr auto prefix = static_cast<std::string_view>(Prefix);
+        static_assert(prefix == "/" || (prefix.starts_with('/') && not prefix.ends_with('/')),
+                      "Static files prefix must start with '/' and not end with one");
+
+        // paths are matched after the prefix and the '/' that follows it
+        m_router->add_static_files(std::string(prefix == "/" ? "" : prefix), root);
+    }
+
+    // Count requests, latencies, connections and bytes, and serve them at `Path` in the
+    // Prometheus text format, e.g. `serve_metrics<"/metrics">()`. Routes are matched first
+    template<meta::string Path>
+    void serve_metrics()
+    {
+        constexpr auto path = static_cast<std::string_view>(Path);
+        static_assert(path.starts_with('/'), "Metrics path must start with '/'");
+
+        m_router->serve_metrics(std::string(path));
+    }
+
+    // Time each stage of the last `capacity` requests of each thread, and serve the slowest of them
+    // at `Path`, e.g. `serve_traces<"/traces">()`. "?slowest=50" asks for that many, and "&format=chrome"
+    // for a Chrome trace to open in chrome://tracing or Perfetto. Routes are matched first
+    template<meta::string Path>
+    void serve_traces(size_t capacity = detail::tracer::default_capacity)
+    {
+        constexpr auto path = static_cast<std::string_view>(Path);
+        static_assert(path.starts_with('/'), "Traces path must start with '/'");
+
+        m_router->serve_traces(std::string(path), capacity);
+    }
+
     void add_not_found_handler(not_found_handler_t handler)
     {
         m_router->add_not_found_handler(std::move(handler));
     }
 
+    void add_method_not_allowed_handler(method_not_allowed_handler_t handler)
+    {
+        m_router->add_method_not_allowed_handler(std::move(handler));
+    }
+
+    void add_payload_too_large_handler(payload_too_large_handler_t handler)
+    {
+        m_router->add_payload_too_large_handler(std::move(handler));
+    }
+
+    void add_unsupported_media_type_handler(unsupported_media_type_handler_t handler)
+    {
+        m_router->add_unsupported_media_type_handler(std::move(handler));
+    }
+
     void add_exception_handler(exception_handler_t handler)
     {
         m_router->add_exception_handler(std::move(handler));
@@ -103,38 +465,88 @@ class application
 
     void run()
     {
+        // every route has been added by now
+        m_router->start_metrics(m_router->route_labels().size());
+
+        if (m_config->thread_per_core)
+        {
+            return run_per_core();
+        }
+
+        auto& ioc = *m_iocs.front();
+
         // Create and launch a listening port
-        std::make_shared<detail::listener>(m_config, m_ioc, m_router, m_socket_error_handler)->run();
+        std::make_shared<detail::listener<router_t>>(m_config, ioc, m_router, m_socket_error_handler, m_connections)
+            ->run();
 
         // Run the I/O service on the requested number of threads
         m_threads.reserve(m_config->num_threads - 1);
         for (auto i = m_config->num_threads - 1; i > 0; --i)
         {
-            m_threads.emplace_back([&] { m_ioc.run(); });
+            m_threads.emplace_back([&] { ioc.run(); });
         }
 
-        m_ioc.run();
+        ioc.run();
 
-        for (auto& thread : m_threads)
-        {
-            thread.join();
-        }
+        join();
     }
 
     template<typename... Arg>
     void stop_on_signals(Arg&&... arg)
     {
-        m_signals = std::make_unique<net::signal_set>(m_ioc, std::forward<Arg>(arg)...);
+        m_signals = std::make_unique<net::signal_set>(*m_iocs.front(), std::forward<Arg>(arg)...);
         m_signals->async_wait(
             [&](beast::error_code const&, int)
             {
-                // Stop the `io_context`. This will cause `run()`
+                // Stop the `io_context`s. This will cause `run()`
                 // to return immediately, eventually destroying the
-                // `io_context` and all of the sockets in it.
-                m_ioc.stop();
+                // `io_context`s and all of the sockets in them.
+                stop();
             });
     }
 
-    void stop() { m_ioc.stop(); }
+    void stop()
+    {
+        for (auto& ioc : m_iocs)
+        {
+            ioc->stop();
+        }
+    }
+
+  private:
+    // Every thread accepts its own connections and runs them to the end, sharing only the router
+    void run_per_core()
+    {
+        // all of them listen before any connection is accepted, so a bind error is thrown here
+        for (auto& ioc : m_iocs)
+        {
+            std::make_shared<detail::listener<router_t>>(
+                m_config, *ioc, m_router, m_socket_error_handler, m_connections)
+                ->run();
+        }
+
+        // the calling thread only waits, so that it isn't left pinned once this returns
+        m_threads.reserve(m_iocs.size());
+        for (size_t i = 0; i < m_iocs.size(); i++)
+        {
+            m_threads.emplace_back(
+                [this, i]
+                {
+                    detail::pin_to_core(i);
+                    m_iocs[i]->run();
+                });
+        }
+
+        join();
+    }
+
+    void join()
+    {
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+        m_threads.clear();
+    }
 };
 }  // namespace mech_suit
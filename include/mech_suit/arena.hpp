@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace mech_suit::detail
+{
+// Bump allocator whose blocks are kept when it is reset, so a connection only
+// goes to the heap until it has seen its largest request.
+// Allocations bigger than a block (large bodies, mostly) get their own
+// allocation, which is freed on reset rather than kept for the next request
+class arena
+{
+    static constexpr size_t block_size = 8 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::vector<std::unique_ptr<std::byte[]>> m_oversized;
+    size_t m_block = 0;
+    size_t m_offset = 0;
+
+  public:
+    arena() = default;
+    arena(const arena&) = delete;
+    auto operator=(const arena&) -> arena& = delete;
+    arena(arena&&) = delete;
+    auto operator=(arena&&) -> arena& = delete;
+    ~arena() = default;
+
+    auto allocate(size_t size, size_t align) -> void*
+    {
+        if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            throw std::bad_alloc();
+        }
+
+        if (size > block_size)
+        {
+            return m_oversized.emplace_back(std::make_unique_for_overwrite<std::byte[]>(size)).get();
+        }
+
+        while (true)
+        {
+            if (m_block == m_blocks.size())
+            {
+                m_blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(block_size));
+            }
+
+            const auto offset = (m_offset + align - 1) & ~(align - 1);
+            if (offset + size <= block_size)
+            {
+                m_offset = offset + size;
+                return m_blocks[m_block].get() + offset;
+            }
+
+            m_block++;
+            m_offset = 0;
+        }
+    }
+
+    // Everything allocated from the arena is gone after this
+    void reset()
+    {
+        m_oversized.clear();
+        m_block = 0;
+        m_offset = 0;
+    }
+};
+
+// Allocates from an arena, or from the heap when default constructed.
+// Deallocating arena memory does nothing, it is all reclaimed by `arena::reset`
+template<typename T>
+class arena_allocator
+{
+    template<typename U>
+    friend class arena_allocator;
+
+    arena* m_arena = nullptr;
+
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    arena_allocator() = default;
+
+    explicit arena_allocator(arena& memory) noexcept
+        : m_arena(&memory)
+    {
+    }
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U>& other) noexcept  // NOLINT(*-explicit-*)
+        : m_arena(other.m_arena)
+    {
+    }
+
+    auto allocate(size_t count) -> T*
+    {
+        if (m_arena == nullptr)
+        {
+            return std::allocator<T> {}.allocate(count);
+        }
+
+        return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t count) noexcept
+    {
+        if (m_arena == nullptr)
+        {
+            std::allocator<T> {}.deallocate(ptr, count);
+        }
+    }
+
+    template<typename U>
+    friend auto operator==(const arena_allocator& lhs, const arena_allocator<U>& rhs) noexcept -> bool
+    {
+        return lhs.m_arena == rhs.m_arena;
+    }
+};
+}  // namespace mech_suit::detail
@@ -1,15 +1,34 @@
 #pragma once
 
+#include <functional>
 #include <string>
+#include <string_view>
 #include <utility>
+
+#include <boost/beast/http/message_generator.hpp>
 #include <glaze/glaze.hpp>
 
+#include "mech_suit/boost.hpp"
+
 namespace mech_suit
 {
 struct body_string : std::type_identity<std::string>
 {
 };
 
+// What the callback of a `body_stream` route returns, as soon as the headers of a request are read.
+// `on_chunk` is called with each piece of the body as it arrives, then `on_end` makes the response
+struct stream_handler
+{
+    std::function<void(std::string_view)> on_chunk;
+    std::function<http::message_generator()> on_end;
+};
+
+// The body is handed to the route a chunk at a time instead of being read into memory first
+struct body_stream : std::type_identity<stream_handler>
+{
+};
+
 template<typename T, glz::opts Opts = glz::opts{.format = glz::json}>
 struct body_glz : std::type_identity<T>
 {
@@ -22,6 +41,12 @@ using body_json = body_glz<T, Opts>;
 template<typename T, glz::opts Opts = glz::opts{.format = glz::binary}>
 using body_binary = body_glz<T, Opts>;
 
+// Read as JSON, or as glaze binary when the request's Content-Type is "application/beve"
+template<typename T>
+struct body_glz_any : std::type_identity<T>
+{
+};
+
 template<typename T>
 struct body_is_glz : std::false_type
 {
@@ -35,5 +60,18 @@ struct body_is_glz<body_glz<T, Opts>> : std::true_type
 template<typename T>
 static constexpr bool body_is_glz_v = body_is_glz<T>();
 
+template<typename T>
+struct body_is_glz_any : std::false_type
+{
+};
+
+template<typename T>
+struct body_is_glz_any<body_glz_any<T>> : std::true_type
+{
+};
+
+template<typename T>
+static constexpr bool body_is_glz_any_v = body_is_glz_any<T>();
+
 using no_body_t = std::type_identity<std::false_type>;
 }  // namespace mech_suit
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit::detail
+{
+// Read buffers left over from finished sessions, kept per thread so the next
+// connection accepted on that thread can start with an already allocated buffer
+class buffer_pool
+{
+    static constexpr size_t max_pooled = 64;
+
+    // a buffer that grew this big for one connection shouldn't be kept around for all of them
+    static constexpr size_t max_pooled_capacity = 64 * 1024;
+
+    static inline thread_local std::vector<beast::flat_buffer> t_buffers {};
+
+  public:
+    static auto acquire() -> beast::flat_buffer
+    {
+        if (t_buffers.empty())
+        {
+            return {};
+        }
+
+        auto buffer = std::move(t_buffers.back());
+        t_buffers.pop_back();
+        return buffer;
+    }
+
+    static void release(beast::flat_buffer&& buffer)
+    {
+        if (t_buffers.size() >= max_pooled || buffer.capacity() == 0
+            || buffer.capacity() > max_pooled_capacity)
+        {
+            return;
+        }
+
+        buffer.clear();
+        t_buffers.push_back(std::move(buffer));
+    }
+};
+}  // namespace mech_suit::detail
@@ -0,0 +1,357 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <boost/beast/core/buffers_range.hpp>
+#include <boost/beast/http/message_generator.hpp>
+#include <boost/beast/zlib.hpp>
+
+#include "mech_suit/boost.hpp"
+#include "mech_suit/http_request.hpp"
+#include "mech_suit/media_type.hpp"
+#include "mech_suit/response.hpp"
+
+namespace mech_suit
+{
+// When and how hard the responses of a route are compressed
+struct compression_options
+{
+    static constexpr size_t default_min_size = 1024;
+    static constexpr int default_level = 6;
+
+    // smaller bodies aren't worth compressing
+    size_t min_size = default_min_size;
+
+    // from 1, fastest, to 9, smallest
+    int level = default_level;
+};
+
+namespace detail
+{
+enum class content_encoding
+{
+    gzip,
+    deflate,
+};
+
+// The encoding a client sending `accept_encoding` would rather have, if any.
+// gzip wins a tie, and "*" counts for whichever isn't listed itself
+inline auto choose_encoding(std::string_view accept_encoding) -> std::optional<content_encoding>
+{
+    std::optional<int> gzip;
+    std::optional<int> deflate;
+    int others = 0;
+
+    while (not accept_encoding.empty())
+    {
+        const auto coding = accept_encoding.substr(0, accept_encoding.find(','));
+        accept_encoding.remove_prefix(std::min(coding.size() + 1, accept_encoding.size()));
+
+        const auto name = media_type(coding);
+        const auto q = quality(coding);
+
+        if (beast::iequals(name, "gzip") || beast::iequals(name, "x-gzip"))
+        {
+            gzip = std::max(gzip.value_or(0), q);
+        }
+        else if (beast::iequals(name, "deflate"))
+        {
+            deflate = std::max(deflate.value_or(0), q);
+        }
+        else if (name == "*")
+        {
+            others = std::max(others, q);
+        }
+    }
+
+    const auto gzip_q = gzip.value_or(others);
+    const auto deflate_q = deflate.value_or(others);
+
+    if (gzip_q == 0 && deflate_q == 0)
+    {
+        return std::nullopt;
+    }
+
+    return gzip_q >= deflate_q ? content_encoding::gzip : content_encoding::deflate;
+}
+
+// Text compresses well, while most binary formats are compressed already
+inline auto is_compressible(std::string_view content_type) -> bool
+{
+    const auto type = media_type(content_type);
+    return type.starts_with("text/") || type.ends_with("+json") || type.ends_with("+xml")
+        || beast::iequals(type, json_media_type) || beast::iequals(type, "application/javascript")
+        || beast::iequals(type, "application/xml") || beast::iequals(type, "image/svg+xml");
+}
+
+// Continues `crc` with `data`, so a body can be checked a piece at a time
+inline auto crc32(std::string_view data, uint32_t crc = 0) -> uint32_t
+{
+    static constexpr auto table = []
+    {
+        constexpr uint32_t polynomial = 0xEDB88320;
+
+        std::array<uint32_t, 256> entries {};
+        for (uint32_t i = 0; i < entries.size(); i++)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                value = (value & 1) != 0 ? (value >> 1) ^ polynomial : value >> 1;
+            }
+            entries[i] = value;
+        }
+        return entries;
+    }();
+
+    crc ^= 0xFFFFFFFF;
+    for (const auto byte : data)
+    {
+        crc = table[(crc ^ static_cast<uint8_t>(byte)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Continues `adler` with `data`, like `crc32`
+inline auto adler32(std::string_view data, uint32_t adler = 1) -> uint32_t
+{
+    constexpr uint32_t modulus = 65521;
+
+    // the most bytes that can be summed before the sums could overflow
+    constexpr size_t max_run = 5552;
+
+    uint32_t low = adler & 0xFFFF;
+    uint32_t high = adler >> 16;
+    while (not data.empty())
+    {
+        const auto run = data.substr(0, max_run);
+        data.remove_prefix(run.size());
+
+        for (const auto byte : run)
+        {
+            low += static_cast<uint8_t>(byte);
+            high += low;
+        }
+
+        low %= modulus;
+        high %= modulus;
+    }
+
+    return (high << 16) | low;
+}
+
+template<typename Int>
+void append_little_endian(std::string& out, Int value)
+{
+    for (size_t i = 0; i < sizeof(Int); i++)
+    {
+        out += static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+}
+
+template<typename Int>
+void append_big_endian(std::string& out, Int value)
+{
+    for (size_t i = sizeof(Int); i > 0; i--)
+    {
+        out += static_cast<char>((value >> ((i - 1) * 8)) & 0xFF);
+    }
+}
+
+// Appends a body written to it a piece at a time to `out`, compressed in `encoding`.
+// Both encodings wrap a raw deflate stream
+class body_compressor
+{
+    content_encoding m_encoding;
+    std::string& m_out;
+
+    // where the deflate stream starts in `m_out`
+    size_t m_start = 0;
+
+    beast::zlib::z_params m_params {};
+    uint32_t m_check;
+
+    // its buffers are big, so they are kept for the next response compressed on the thread
+    static auto stream() -> beast::zlib::deflate_stream&
+    {
+        static thread_local beast::zlib::deflate_stream stream;
+        return stream;
+    }
+
+    // With room for the upper bound of everything written so far, no write runs out of room
+    void reserve(size_t more)
+    {
+        const auto written = static_cast<size_t>(m_params.total_out);
+        m_out.resize(m_start + stream().upper_bound(m_params.total_in + more));
+        m_params.next_out = m_out.data() + m_start + written;
+        m_params.avail_out = m_out.size() - m_start - written;
+    }
+
+    void deflate(std::string_view data, beast::zlib::Flush flush)
+    {
+        reserve(data.size());
+        m_params.next_in = data.data();
+        m_params.avail_in = data.size();
+
+        beast::error_code err;
+        stream().write(m_params, flush, err);
+        if (err && err != beast::zlib::error::end_of_stream && err != beast::zlib::error::need_buffers)
+        {
+            throw beast::system_error(err);
+        }
+    }
+
+  public:
+    body_compressor(content_encoding encoding, int level, std::string& out)
+        : m_encoding(encoding)
+        , m_out(out)
+        , m_check(encoding == content_encoding::gzip ? crc32({}) : adler32({}))
+    {
+        constexpr int window_bits = 15;
+        constexpr int mem_level = 8;
+
+        if (encoding == content_encoding::gzip)
+        {
+            // magic, deflate, no flags, no modification time, no extra flags, unknown OS
+            m_out.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10);
+        }
+        else
+        {
+            // "deflate" means the zlib format: a 32K window and a check that the header is a multiple of 31
+            m_out.append("\x78\x9c", 2);
+        }
+
+        m_start = m_out.size();
+        stream().reset(level, window_bits, mem_level, beast::zlib::Strategy::normal);
+    }
+
+    void write(std::string_view data)
+    {
+        if (data.empty())
+        {
+            return;
+        }
+
+        m_check = m_encoding == content_encoding::gzip ? crc32(data, m_check) : adler32(data, m_check);
+        deflate(data, beast::zlib::Flush::none);
+    }
+
+    // Ends the stream with the check of everything written
+    void finish()
+    {
+        deflate({}, beast::zlib::Flush::finish);
+        const auto size = static_cast<uint32_t>(m_params.total_in);
+        m_out.resize(m_start + m_params.total_out);
+
+        if (m_encoding == content_encoding::gzip)
+        {
+            append_little_endian(m_out, m_check);
+            append_little_endian(m_out, size);
+        }
+        else
+        {
+            append_big_endian(m_out, m_check);
+        }
+    }
+};
+
+// Compress the body of `response` as it would be written, a buffer at a time
+template<typename Body, typename Fields>
+void compress_body(http::response<Body, Fields>& response, content_encoding encoding, int level, std::string& out)
+{
+    body_compressor compressor {encoding, level, out};
+
+    typename Body::writer writer {response.base(), response.body()};
+    beast::error_code err;
+    writer.init(err);
+    while (not err)
+    {
+        const auto next = writer.get(err);
+        if (err || not next)
+        {
+            break;
+        }
+
+        for (const auto buffer : beast::buffers_range_ref(next->first))
+        {
+            compressor.write({static_cast<const char*>(buffer.data()), buffer.size()});
+        }
+
+        if (not next->second)
+        {
+            break;
+        }
+    }
+
+    if (err)
+    {
+        throw beast::system_error(err);
+    }
+
+    compressor.finish();
+}
+
+// Compress the body of `response`, if `request` accepts it and it is worth it, before it is serialized.
+// It is marked as depending on Accept-Encoding either way
+template<typename Body, typename Fields>
+auto compress_response(const http_request& request,
+                       http::response<Body, Fields>&& response,
+                       const compression_options& options) -> http::message_generator
+{
+    if (response.count(http::field::content_encoding) != 0 || response.chunked()
+        || not is_compressible(response[http::field::content_type]))
+    {
+        return std::move(response);
+    }
+
+    const auto vary = response[http::field::vary];
+    response.set(http::field::vary, vary.empty() ? std::string("Accept-Encoding") : std::string(vary) + ", Accept-Encoding");
+
+    // a body of unknown size would be chunked, so it is written as is
+    const auto encoding = choose_encoding(request.beast_request[http::field::accept_encoding]);
+    const auto size = response.payload_size();
+    if (not encoding || not size || *size < options.min_size)
+    {
+        return std::move(response);
+    }
+
+    pooled_string_body::value_type body;
+    compress_body(response, *encoding, options.level, body.str());
+
+    http::response<pooled_string_body, Fields> compressed {std::move(response.base()), std::move(body)};
+    compressed.set(http::field::content_encoding, *encoding == content_encoding::gzip ? "gzip" : "deflate");
+    compressed.content_length(compressed.body().str().size());
+    return compressed;
+}
+
+// `Function`, the type of a route's callback, for a callback that returns a response or value.
+// What it returns is compressed as set in `compression` before it becomes a `message_generator`
+template<typename Function>
+struct compressed_callback;
+
+template<typename... Args>
+struct compressed_callback<std::function<http::message_generator(const http_request&, Args...)>>
+{
+    using type = std::function<http::message_generator(const http_request&, Args...)>;
+
+    template<typename Callback>
+    static auto make(Callback callback, std::optional<compression_options> compression) -> type
+    {
+        return [callback = std::move(callback), compression](const http_request& request,
+                                                             Args... args) -> http::message_generator
+        {
+            if (not compression)
+            {
+                return to_response(request, callback(request, args...));
+            }
+
+            return compress_response(request, to_message(request, callback(request, args...)), *compression);
+        };
+    }
+};
+}  // namespace detail
+}  // namespace mech_suit
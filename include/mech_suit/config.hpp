@@ -1,6 +1,8 @@
 #pragma once
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <string>
 #include <thread>
 
 namespace mech_suit
@@ -10,10 +12,51 @@ struct config
     static constexpr uint16_t default_port = 3000;
     static constexpr auto default_address = "0.0.0.0";
     static constexpr std::chrono::duration<unsigned int> default_timeout = std::chrono::seconds(30);
+    static constexpr std::chrono::duration<unsigned int> default_header_timeout = std::chrono::seconds(10);
+    static constexpr size_t default_pipeline_depth = 8;
+    static constexpr size_t default_stream_chunk_size = 64 * 1024;
+    static constexpr uint64_t default_max_body_size = 1024 * 1024;
+    static constexpr std::chrono::duration<unsigned int> default_retry_after = std::chrono::seconds(1);
 
     std::string address = default_address;
     uint16_t port = default_port;
     size_t num_threads = std::thread::hardware_concurrency();
+
+    // For writing a response
     std::chrono::duration<unsigned int> connection_timeout = default_timeout;
+
+    // For a kept alive connection to start its next request
+    std::chrono::duration<unsigned int> idle_timeout = default_timeout;
+
+    // For the headers of a request, from its first byte or, for the first request, from the
+    // connection being accepted. So a client can't hold a connection by sending them slowly
+    std::chrono::duration<unsigned int> header_timeout = default_header_timeout;
+
+    // For a body to be read in full, or for each chunk of a `body_stream` body
+    std::chrono::duration<unsigned int> body_timeout = default_timeout;
+
+    // How many pipelined requests a connection may have waiting on their
+    // responses before it stops reading more
+    size_t pipeline_depth = default_pipeline_depth;
+
+    // The most of a `body_stream` body that is read before it is handed to the route
+    size_t stream_chunk_size = default_stream_chunk_size;
+
+    // The largest body that is read in full before a route is called.
+    // A request declaring a bigger one is rejected before any of it is read.
+    // `body_stream` bodies aren't limited
+    uint64_t max_body_size = default_max_body_size;
+
+    // The most connections open at once, across every thread. A connection over the limit
+    // is sent a 503 and closed without its request being read. 0 for no limit
+    size_t max_connections = 0;
+
+    // Sent as the Retry-After of those 503s
+    std::chrono::duration<unsigned int> retry_after = default_retry_after;
+
+    // Give each of the `num_threads` threads its own `io_context`, pinned to a core and
+    // accepting on its own SO_REUSEPORT socket. Connections stay on the thread that accepted
+    // them, so they need no strands and no thread waits on another's queue
+    bool thread_per_core = false;
 };
 }  // namespace mech_suit
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace mech_suit::detail
+{
+// Counts the open connections of every listener of an application against `config::max_connections`
+class connection_limit : public std::enable_shared_from_this<connection_limit>
+{
+    std::atomic<size_t> m_count {0};
+    size_t m_max;
+
+  public:
+    // Held by a connection for as long as it is open
+    class slot
+    {
+        std::shared_ptr<connection_limit> m_limit;
+
+      public:
+        slot() = default;
+
+        explicit slot(std::shared_ptr<connection_limit> limit)
+            : m_limit(std::move(limit))
+        {
+        }
+
+        slot(const slot&) = delete;
+        auto operator=(const slot&) -> slot& = delete;
+        slot(slot&&) noexcept = default;
+
+        auto operator=(slot&& other) noexcept -> slot&
+        {
+            std::swap(m_limit, other.m_limit);
+            return *this;
+        }
+
+        ~slot()
+        {
+            if (m_limit)
+            {
+                m_limit->m_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // 0 for no limit
+    explicit connection_limit(size_t max)
+        : m_max(max)
+    {
+    }
+
+    // Nothing if there are already as many connections as allowed
+    auto try_acquire() -> std::optional<slot>
+    {
+        const auto count = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (m_max != 0 && count >= m_max)
+        {
+            m_count.fetch_sub(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        return slot {shared_from_this()};
+    }
+
+    [[nodiscard]] auto count() const -> size_t { return m_count.load(std::memory_order_relaxed); }
+};
+}  // namespace mech_suit::detail
@@ -1,6 +1,12 @@
 #pragma once
+#include <exception>
 #include <functional>
+#include <span>
+#include <string>
+#include <utility>
+
 #include <boost/beast/core/error.hpp>
+#include <boost/beast/http/message_generator.hpp>
 #include <glaze/core/context.hpp>
 
 #include "mech_suit/http_request.hpp"
@@ -13,4 +19,177 @@ using exception_handler_t =
 using glz_parse_error_handler_t =
     std::function<http::message_generator(http_request const&, glz::parse_error)>;
 using socket_error_handler_t = std::function<void(beast::error_code)>;
+using method_not_allowed_handler_t =
+    std::function<http::message_generator(http_request const&, std::span<const http::verb> allowed)>;
+using payload_too_large_handler_t = std::function<http::message_generator(http_request const&)>;
+using unsupported_media_type_handler_t = std::function<http::message_generator(http_request const&)>;
+
+namespace detail
+{
+// The user configurable error handlers shared by every kind of router
+class router_error_handlers
+{
+    static auto not_found(const http_request& request) -> http::message_generator
+    {
+        http::response<http::string_body> res {http::status::not_found,
+                                               request.beast_request.version()};
+
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = "Not found\n";
+        res.prepare_payload();
+
+        return res;
+    }
+
+    static auto method_not_allowed(const http_request& request, std::span<const http::verb> allowed)
+        -> http::message_generator
+    {
+        http::response<http::string_body> res {http::status::method_not_allowed,
+                                               request.beast_request.version()};
+
+        std::string allow;
+        for (const auto method : allowed)
+        {
+            allow += allow.empty() ? "" : ", ";
+            allow += http::to_string(method);
+        }
+
+        res.set(http::field::allow, allow);
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = "Method not allowed\n";
+        res.prepare_payload();
+
+        return res;
+    }
+
+    static auto payload_too_large(const http_request& request) -> http::message_generator
+    {
+        http::response<http::string_body> res {http::status::payload_too_large,
+                                               request.beast_request.version()};
+
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = "Payload too large\n";
+        res.prepare_payload();
+
+        return res;
+    }
+
+    static auto unsupported_media_type(const http_request& request) -> http::message_generator
+    {
+        http::response<http::string_body> res {http::status::unsupported_media_type,
+                                               request.beast_request.version()};
+
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = "Unsupported media type\n";
+        res.prepare_payload();
+
+        return res;
+    }
+
+    static auto unprocessable(const http_request& request, glz::parse_error error)
+        -> http::message_generator
+    {
+
+        std::string message = glz::format_error(error, request.beast_request.body());
+
+        http::response<http::string_body> res {http::status::unprocessable_entity,
+                                               request.beast_request.version()};
+
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = std::move(message);
+        res.prepare_payload();
+
+        return res;
+    }
+
+    static auto exception(const http_request& request, std::exception const& except)
+        -> http::message_generator
+    {
+        http::response<http::string_body> res {http::status::internal_server_error,
+                                               request.beast_request.version()};
+
+        res.set(http::field::content_type, "text/html");
+        res.keep_alive(false);
+        res.body() = except.what();
+        res.prepare_payload();
+
+        return res;
+    }
+
+  protected:
+    glz_parse_error_handler_t m_glz_parse_error_handler = router_error_handlers::unprocessable;
+    exception_handler_t m_exception_handler = router_error_handlers::exception;
+    not_found_handler_t m_not_found_handler = router_error_handlers::not_found;
+    method_not_allowed_handler_t m_method_not_allowed_handler = router_error_handlers::method_not_allowed;
+    payload_too_large_handler_t m_payload_too_large_handler = router_error_handlers::payload_too_large;
+    unsupported_media_type_handler_t m_unsupported_media_type_handler = router_error_handlers::unsupported_media_type;
+
+    // A path that is routed for other methods is not allowed, rather than not found
+    auto handle_unmatched(const http_request& request, std::span<const http::verb> allowed) const
+        -> http::message_generator
+    {
+        if (allowed.empty())
+        {
+            return m_not_found_handler(request);
+        }
+
+        return m_method_not_allowed_handler(request, allowed);
+    }
+
+  public:
+    void add_not_found_handler(not_found_handler_t handler)
+    {
+        m_not_found_handler = std::move(handler);
+    }
+
+    void add_exception_handler(exception_handler_t handler)
+    {
+        m_exception_handler = std::move(handler);
+    }
+
+    void add_glz_parse_error_handler(glz_parse_error_handler_t handler)
+    {
+        m_glz_parse_error_handler = std::move(handler);
+    }
+
+    void add_method_not_allowed_handler(method_not_allowed_handler_t handler)
+    {
+        m_method_not_allowed_handler = std::move(handler);
+    }
+
+    void add_payload_too_large_handler(payload_too_large_handler_t handler)
+    {
+        m_payload_too_large_handler = std::move(handler);
+    }
+
+    void add_unsupported_media_type_handler(unsupported_media_type_handler_t handler)
+    {
+        m_unsupported_media_type_handler = std::move(handler);
+    }
+
+    // For a body bigger than `config::max_body_size`, found before or while it is read
+    auto handle_payload_too_large(const http_request& request) const -> http::message_generator
+    {
+        return m_payload_too_large_handler(request);
+    }
+
+    // For a body whose Content-Type isn't the format its route reads, found before it is read
+    auto handle_unsupported_media_type(const http_request& request) const -> http::message_generator
+    {
+        return m_unsupported_media_type_handler(request);
+    }
+
+    // For when a route throws outside of `handle_request`, while its body is being streamed
+    auto handle_exception(const http_request& request, std::exception const& except) const
+        -> http::message_generator
+    {
+        return m_exception_handler(request, except);
+    }
+};
+}  // namespace detail
 }  // namespace mech_suit
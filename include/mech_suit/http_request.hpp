@@ -1,11 +1,21 @@
 #pragma once
+#include <string>
+#include <tuple>
+
+#include "mech_suit/arena.hpp"
 #include "mech_suit/boost.hpp"
+#include "mech_suit/tracing.hpp"
+
 namespace mech_suit
 {
 struct http_request
 {
-    using beast_request_t = http::request<http::string_body>;
+    using allocator_t = detail::arena_allocator<char>;
+    using body_t = http::basic_string_body<char, std::char_traits<char>, allocator_t>;
+    using fields_t = http::basic_fields<allocator_t>;
+    using beast_request_t = http::request<body_t, fields_t>;
 
+    http_request() = default;
     http_request(const http_request&) = delete;
     auto operator=(const http_request&) -> http_request& = delete;
     http_request(http_request&&) = default;
@@ -14,8 +24,23 @@ struct http_request
 
     explicit http_request(beast_request_t&& req)
         : beast_request(std::move(req))
+    {
+        parse_target();
+    }
+
+    // Headers and body of every request read into this one are allocated from `memory`
+    explicit http_request(detail::arena& memory)
+        : beast_request(std::piecewise_construct,
+                        std::make_tuple(allocator_t {memory}),
+                        std::make_tuple(allocator_t {memory}))
+    {
+    }
+
+    // Point `path` and `query` into the target of `beast_request`
+    void parse_target()
     {
         path = beast_request.target();
+        query = {};
 
         // parse query
         const auto query_pos = path.find('?');
@@ -29,8 +54,27 @@ struct http_request
         path = path.size() > 1 && path.back() == '/' ? path.substr(0, path.size() - 1) : path;
     }
 
+    // Empty the request so that another can be read into it.
+    // This gives back everything it allocated, so its arena can be reset afterwards
+    void clear()
+    {
+        beast_request.clear();
+        beast_request.method_string({});
+        beast_request.target({});
+        beast_request.version(11);
+
+        // Swapped rather than assigned, which would keep the old buffer, soon to be reused by the arena
+        auto& body = beast_request.body();
+        body_t::value_type(body.get_allocator()).swap(body);
+        path = {};
+        query = {};
+    }
+
     beast_request_t beast_request;
     std::string_view path;
     std::string_view query;
+
+    // Set by the connection while requests are traced, for the stages that happen in the route
+    detail::request_trace* trace = nullptr;
 };
 }  // namespace mech_suit
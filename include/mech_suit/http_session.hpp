@@ -1,99 +1,847 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <variant>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 #include <boost/beast/http/string_body.hpp>
 
+#include "mech_suit/arena.hpp"
 #include "mech_suit/boost.hpp"
+#include "mech_suit/buffer_pool.hpp"
 #include "mech_suit/config.hpp"
+#include "mech_suit/connection_limit.hpp"
 #include "mech_suit/error_handlers.hpp"
 #include "mech_suit/http_request.hpp"
+#include "mech_suit/metrics.hpp"
+#include "mech_suit/response_cache.hpp"
 #include "mech_suit/router.hpp"
+#include "mech_suit/static_files.hpp"
+#include "mech_suit/timer_wheel.hpp"
+#include "mech_suit/tracing.hpp"
 
 namespace mech_suit::detail
 {
-class http_session : public std::enable_shared_from_this<http_session>
+// Serves the requests of a connection over `Stream`, a `beast::tcp_stream` unless it is run
+// without a socket, e.g. over a `memory_stream`
+template<typename Router, typename Stream = beast::tcp_stream>
+class http_session : public std::enable_shared_from_this<http_session<Router, Stream>>
 {
+    // A socket can be shut down for sending, and be sent a file by the kernel
+    static constexpr bool is_socket = std::is_same_v<Stream, beast::tcp_stream>;
+
     std::shared_ptr<config> m_config;
-    beast::flat_buffer m_buffer;
-    beast::tcp_stream m_stream;
-    http_request::beast_request_t m_request;
-    std::shared_ptr<const router> m_router;
+    beast::flat_buffer m_buffer = buffer_pool::acquire();
+    Stream m_stream;
+
+    // Read and write timeouts, on the wheel shared by the connections of the `io_context`
+    // rather than the timers of `m_stream`
+    timer_wheel& m_wheel = timer_wheel_of(m_stream.get_executor());
+    deadline m_read_deadline {[this] { on_deadline(); }};
+    deadline m_write_deadline {[this] { on_deadline(); }};
+    bool m_timed_out = false;
+
+    // Requests whose headers have been read on this connection
+    size_t m_requests = 0;
+
+    // How much is read at once while waiting for a request, as for headers
+    static constexpr size_t idle_read_size = 64 * 1024;
+
+    // Headers and bodies of requests on this connection, reset between requests
+    arena m_arena;
+
+    // Read into again for every request on the connection
+    http_request m_request {m_arena};
+
+    // Reads the headers, then the body unless the route streams it
+    std::optional<http::request_parser<http_request::body_t, http_request::allocator_t>> m_parser;
+    typename Router::route_match m_match;
+
+    // Takes over from `m_parser` to read a streamed body into `m_chunk`, one chunk at a time
+    std::optional<http::request_parser<http::buffer_body, http_request::allocator_t>> m_stream_parser;
+    stream_handler m_stream_handler;
+    char* m_chunk = nullptr;
+
+    // A response waiting to be written, and what it is counted as in `metrics`
+    struct queued_response
+    {
+        response_t response;
+        size_t route = 0;
+        std::chrono::steady_clock::time_point start {};
+
+        // Once known, for a response that isn't serialized until it is written
+        unsigned status = 0;
+
+        // Of the request, while requests are traced
+        request_trace trace {};
+    };
+
+    // Responses in request order. The front one is being written
+    std::queue<queued_response> m_responses;
+    bool m_reading = false;
+    bool m_closing = false;
+
+    // How much of the file of the front response has been sent
+    uint64_t m_file_offset = 0;
+
+    // A chunk of that file, when it is copied rather than sent by the kernel
+    std::vector<char> m_file_buffer;
+
+    std::shared_ptr<const Router> m_router;
     socket_error_handler_t m_socket_error_handler;
 
+    // Counts this connection against `config::max_connections` until it is destroyed
+    connection_limit::slot m_slot;
+
+    // Nothing unless the router serves metrics
+    metrics* m_metrics = nullptr;
+
+    // Nothing unless the router serves traces. `m_request` points to `m_trace` while it is set
+    tracer* m_tracer = nullptr;
+    request_trace m_trace;
+
+    // What the responses to the current request are counted and traced as
+    size_t m_route_id = 0;
+    std::chrono::steady_clock::time_point m_request_start {};
+
   public:
     explicit http_session(std::shared_ptr<config> conf,
-                          tcp::socket socket,
-                          std::shared_ptr<const router> router,
-                          socket_error_handler_t socket_error_handler)
+                          Stream stream,
+                          std::shared_ptr<const Router> router,
+                          socket_error_handler_t socket_error_handler,
+                          connection_limit::slot slot = {})
         : m_config(std::move(conf))
-        , m_stream(std::move(socket))
+        , m_stream(std::move(stream))
         , m_router(std::move(router))
         , m_socket_error_handler(std::move(socket_error_handler))
+        , m_slot(std::move(slot))
+        , m_metrics(m_router->get_metrics())
+        , m_tracer(m_router->get_tracer())
     {
+        if (m_metrics)
+        {
+            m_metrics->connection_opened();
+        }
+
+        if (m_tracer)
+        {
+            m_request.trace = &m_trace;
+            m_trace.mark(request_trace::accepted);
+        }
     }
 
-    http_session(http_session&&) noexcept = default;
-    auto operator=(http_session&&) noexcept -> http_session& = default;
+    http_session(http_session&&) = delete;
+    auto operator=(http_session&&) -> http_session& = delete;
     http_session(http_session&) = delete;
     auto operator=(const http_session&) -> http_session& = delete;
-    ~http_session() = default;
+    ~http_session()
+    {
+        if (m_metrics)
+        {
+            m_metrics->connection_closed();
+        }
+
+        buffer_pool::release(std::move(m_buffer));
+    }
 
     // Start the asynchronous operation
     void run()
     {
         // We need to be executing within a strand to perform async operations
-        // on the I/O objects in this session. Although not strictly necessary
-        // for single-threaded contexts, this example code is written to be
-        // thread-safe by default.
+        // on the I/O objects in this session, unless its `io_context` is only
+        // run by one thread, as with `config::thread_per_core`.
         net::dispatch(m_stream.get_executor(),
-                      beast::bind_front_handler(&http_session::do_read, shared_from_this()));
+                      beast::bind_front_handler(&http_session::do_read, this->shared_from_this()));
     }
 
     void do_read()
     {
-        // Make sure request is reset
-        m_request = {};
+        m_reading = true;
+
+        // Make sure request is reset. Nothing refers to the last one
+        // once its response is queued, so its memory can be reused
+        m_stream_parser.reset();
+        m_stream_handler = {};
+        m_parser.reset();
+        m_request.clear();
+        m_arena.reset();
+
+        m_parser.emplace(std::piecewise_construct,
+                         std::make_tuple(http_request::allocator_t {m_arena}),
+                         std::make_tuple(http_request::allocator_t {m_arena}));
+
+        // The body is limited once the route is known, as a streamed one isn't
+        m_parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+
+        // A new connection, or one that already sent its next request, is only given
+        // as long as it takes to send the headers
+        if (m_requests == 0 || m_buffer.size() != 0)
+        {
+            mark_stage(m_request.trace, request_trace::started);
+            return read_header();
+        }
+
+        // Otherwise wait for the next request to start, without a parser being involved
+        m_wheel.expires_after(*this, m_read_deadline, m_config->idle_timeout);
+        m_stream.async_read_some(m_buffer.prepare(beast::read_size(m_buffer, idle_read_size)),
+                                 beast::bind_front_handler(&http_session::on_read_idle, this->shared_from_this()));
+    }
+
+    void on_read_idle(beast::error_code err, std::size_t bytes_transferred)
+    {
+        // They closed the connection between requests
+        if (err == net::error::eof)
+        {
+            return on_read_error(http::error::end_of_stream);
+        }
+
+        if (err)
+        {
+            return on_read_error(err);
+        }
+
+        m_buffer.commit(bytes_transferred);
+        mark_stage(m_request.trace, request_trace::started);
+        read_header();
+    }
+
+    void read_header()
+    {
+        m_wheel.expires_after(*this, m_read_deadline, m_config->header_timeout);
+
+        // Read the headers first, so that the route is known before any of the body is read
+        http::async_read_header(m_stream,
+                                m_buffer,
+                                *m_parser,
+                                beast::bind_front_handler(&http_session::on_read_header, this->shared_from_this()));
+    }
+
+    void on_read_header(beast::error_code err, std::size_t bytes_transferred)
+    {
+        if (err)
+        {
+            return on_read_error(err);
+        }
+
+        m_requests++;
+        count_received(bytes_transferred);
+        mark_stage(m_request.trace, request_trace::headers_read);
+
+        // The parser only needs its message for the body from here on
+        m_request.beast_request.base() = std::move(m_parser->get().base());
+        m_request.parse_target();
+        m_match = m_router->find_route(m_request);
+
+        if (m_metrics || m_tracer)
+        {
+            m_request_start = std::chrono::steady_clock::now();
+            m_route_id = m_match.found() ? Router::route_id(m_match)
+                                         : m_router->special_route_id(metrics::unmatched_route);
+        }
+
+        // Not found or not allowed, so none of the body is wanted
+        if (not m_match.found())
+        {
+            if (auto response = m_router->find_metrics(m_request))
+            {
+                m_route_id = m_router->special_route_id(metrics::metrics_route);
+                return respond_to_headers(std::move(*response));
+            }
+
+            if (auto response = m_router->find_traces(m_request))
+            {
+                m_route_id = m_router->special_route_id(metrics::traces_route);
+                return respond_to_headers(std::move(*response));
+            }
+
+            if (auto file = m_router->find_static_file(m_request))
+            {
+                if (m_metrics || m_tracer)
+                {
+                    m_route_id = m_router->special_route_id(metrics::static_files_route);
+                }
+
+                return respond_to_headers(std::move(*file));
+            }
+
+            return respond_to_headers(m_router->handle_request(m_request, m_match));
+        }
+
+        // A body in a format the route doesn't read isn't read at all
+        if (not m_router->accepts_content_type(m_request, m_match))
+        {
+            return respond_to_headers(m_router->handle_unsupported_media_type(m_request));
+        }
+
+        std::optional<stream_handler> stream;
+        try
+        {
+            stream = m_router->open_stream(m_request, m_match);
+        }
+        catch (std::exception const& except)
+        {
+            return respond_to_headers(m_router->handle_exception(m_request, except));
+        }
+
+        if (stream)
+        {
+            send_continue();
+            return start_stream(std::move(*stream));
+        }
+
+        // Nothing more to read for a request without a body
+        if (m_parser->is_done())
+        {
+            return on_read({}, 0);
+        }
+
+        if (const auto length = m_parser->content_length(); length && *length > m_config->max_body_size)
+        {
+            return respond_to_headers(m_router->handle_payload_too_large(m_request));
+        }
+
+        m_parser->body_limit(m_config->max_body_size);
+
+        m_wheel.expires_after(*this, m_read_deadline, m_config->body_timeout);
+        send_continue();
+
+        if (const auto length = m_parser->content_length(); length && not m_parser->chunked())
+        {
+            return read_body(static_cast<size_t>(*length));
+        }
+
+        http::async_read(
+            m_stream, m_buffer, *m_parser, beast::bind_front_handler(&http_session::on_read, this->shared_from_this()));
+    }
+
+    // A body of known length is read from the socket straight into the request, where it
+    // is parsed, rather than into `m_buffer` to be copied out by the parser.
+    // Only what arrived along with the headers is copied
+    void read_body(size_t length)
+    {
+        auto& body = m_request.beast_request.body();
+        body.resize(length);
 
-        // Set the timeout.
-        m_stream.expires_after(m_config->connection_timeout);
+        const auto buffered = std::min(length, m_buffer.size());
+        net::buffer_copy(net::buffer(body.data(), buffered), m_buffer.data());
+        m_buffer.consume(buffered);
+        count_received(buffered);
+
+        if (buffered == length)
+        {
+            return call_route();
+        }
+
+        net::async_read(m_stream,
+                        net::buffer(body.data() + buffered, length - buffered),
+                        beast::bind_front_handler(&http_session::on_read_body, this->shared_from_this()));
+    }
+
+    void on_read_body(beast::error_code err, std::size_t bytes_transferred)
+    {
+        if (err)
+        {
+            return on_read_error(err);
+        }
+
+        count_received(bytes_transferred);
+
+        call_route();
+    }
+
+    void on_read(beast::error_code err, std::size_t bytes_transferred)
+    {
+        count_received(bytes_transferred);
+
+        // A chunked body can only be found to be too large while it is read
+        if (err == http::error::body_limit)
+        {
+            return abort_request(m_router->handle_payload_too_large(m_request));
+        }
+
+        if (err)
+        {
+            return on_read_error(err);
+        }
+
+        m_request.beast_request.body() = std::move(m_parser->get().body());
+        call_route();
+    }
+
+    void call_route()
+    {
+        timer_wheel::cancel(m_read_deadline);
+
+        if (not m_request.beast_request.body().empty())
+        {
+            mark_stage(m_request.trace, request_trace::body_read);
+        }
+
+        if (m_router->is_async(m_match))
+        {
+            net::co_spawn(m_stream.get_executor(),
+                          handle_async(this->shared_from_this()),
+                          [self = this->shared_from_this()](const std::exception_ptr& except)
+                          {
+                              if (except)
+                              {
+                                  self->on_async_exception(except);
+                              }
+                          });
+            return;
+        }
+
+        finish_request(m_router->handle_request(m_request, m_match));
+    }
+
+    // Something a coroutine route threw past its own handling, such as an exception that isn't a
+    // `std::exception` or one from the exception handler. It must not unwind out of the `io_context`
+    // and stop the thread, along with every other connection on it
+    void on_async_exception(const std::exception_ptr& except)
+    {
+        // Still reading until the response to the request is queued
+        if (m_reading)
+        {
+            try
+            {
+                try
+                {
+                    std::rethrow_exception(except);
+                }
+                catch (std::exception const& error)
+                {
+                    return finish_request(m_router->handle_exception(m_request, error));
+                }
+                catch (...)
+                {
+                    return finish_request(
+                        m_router->handle_exception(m_request, std::runtime_error("Unknown exception")));
+                }
+            }
+            catch (...)
+            {
+                // the exception handler threw as well
+            }
+        }
+
+        m_closing = true;
+        m_socket_error_handler(net::error::operation_aborted);
+        do_close();
+    }
+
+    // The callback runs on the connection's executor and frees the thread while it is suspended.
+    // Nothing else is read into `m_request` until it is done with it
+    static auto handle_async(std::shared_ptr<http_session> self) -> net::awaitable<void>
+    {
+        self->finish_request(co_await self->m_router->handle_request_async(self->m_request, self->m_match));
+    }
+
+    // Tell a client waiting on "Expect: 100-continue" to send the body,
+    // now that it is known that it will be read
+    void send_continue()
+    {
+        const auto& request = m_request.beast_request;
+        if (request.version() < 11 || not beast::iequals(request[http::field::expect], "100-continue"))
+        {
+            return;
+        }
+
+        queue_response(
+            http::message_generator(http::response<http::empty_body> {http::status::continue_, request.version()}));
+    }
+
+    void start_stream(stream_handler&& handler)
+    {
+        m_stream_handler = std::move(handler);
+        m_chunk = static_cast<char*>(m_arena.allocate(m_config->stream_chunk_size, 1));
+
+        // Only a chunk of the body is held at a time, so it isn't limited like a buffered one
+        m_stream_parser.emplace(std::move(*m_parser));
+
+        read_chunk();
+    }
+
+    void read_chunk()
+    {
+        auto& body = m_stream_parser->get().body();
+        body.data = m_chunk;
+        body.size = m_config->stream_chunk_size;
+
+        if (m_stream_parser->is_done())
+        {
+            return on_read_chunk({}, 0);
+        }
+
+        // A long upload only times out if it stalls
+        m_wheel.expires_after(*this, m_read_deadline, m_config->body_timeout);
 
-        // Read a request
         http::async_read(m_stream,
                          m_buffer,
-                         m_request,
-                         beast::bind_front_handler(&http_session::on_read, shared_from_this()));
+                         *m_stream_parser,
+                         beast::bind_front_handler(&http_session::on_read_chunk, this->shared_from_this()));
     }
 
-    void on_read(beast::error_code err, std::size_t bytes_transferred)
+    void on_read_chunk(beast::error_code err, std::size_t bytes_transferred)
     {
-        boost::ignore_unused(bytes_transferred);
+        count_received(bytes_transferred);
+
+        // This means the chunk is full
+        if (err == http::error::need_buffer)
+        {
+            err = {};
+        }
+
+        if (err)
+        {
+            return on_read_error(err);
+        }
+
+        const auto chunk_size = m_config->stream_chunk_size - m_stream_parser->get().body().size;
+
+        std::optional<http::message_generator> response;
+        try
+        {
+            if (chunk_size > 0)
+            {
+                m_stream_handler.on_chunk({m_chunk, chunk_size});
+            }
+
+            if (m_stream_parser->is_done())
+            {
+                mark_stage(m_request.trace, request_trace::body_read);
+                response.emplace(m_stream_handler.on_end());
+            }
+        }
+        catch (std::exception const& except)
+        {
+            return abort_request(m_router->handle_exception(m_request, except));
+        }
+
+        if (response)
+        {
+            return finish_request(std::move(*response));
+        }
+
+        read_chunk();
+    }
+
+    void on_read_error(beast::error_code err)
+    {
+        m_reading = false;
+        timer_wheel::cancel(m_read_deadline);
+
+        if (m_timed_out)
+        {
+            err = beast::error::timeout;
+        }
 
         // This means they closed the connection
         if (err == http::error::end_of_stream)
         {
-            return do_close();
+            // finish writing any responses that are still queued first
+            m_closing = true;
+            if (m_responses.empty())
+            {
+                do_close();
+            }
+            return;
         }
 
-        if (err)
+        // responses already queued still get written, but no more requests are read
+        m_closing = true;
+        m_socket_error_handler(err);
+    }
+
+    void finish_request(response_t&& response)
+    {
+        m_reading = false;
+        timer_wheel::cancel(m_read_deadline);
+
+        mark_stage(m_request.trace, request_trace::handled);
+        queue_response(std::move(response));
+        m_trace = {};
+
+        // Keep parsing pipelined requests, which may already be in the buffer,
+        // while the responses to the earlier ones are written
+        if (not m_closing && m_responses.size() < m_config->pipeline_depth)
+        {
+            do_read();
+        }
+    }
+
+    // Respond before the whole body has been read. What is left of it is
+    // still in the way of the next request, so the connection is closed after
+    void abort_request(response_t&& response)
+    {
+        m_closing = true;
+        finish_request(std::move(response));
+    }
+
+    // Respond from the headers alone, without reading the body if there is one
+    void respond_to_headers(response_t&& response)
+    {
+        if (not m_parser->is_done())
+        {
+            return abort_request(std::move(response));
+        }
+
+        finish_request(std::move(response));
+    }
+
+    static auto keep_alive(const response_t& response) -> bool
+    {
+        if (const auto* file = std::get_if<file_response>(&response))
+        {
+            return file->header.keep_alive();
+        }
+
+        if (const auto* cached = std::get_if<std::shared_ptr<const cached_response>>(&response))
+        {
+            return (*cached)->keep_alive;
+        }
+
+        return std::get<http::message_generator>(response).keep_alive();
+    }
+
+    void queue_response(response_t&& msg)
+    {
+        // Nothing after a "Connection: close" response will be written,
+        // so there is no point reading any more requests
+        if (not keep_alive(msg))
+        {
+            m_closing = true;
+        }
+
+        m_responses.push({std::move(msg), m_route_id, m_request_start, 0, m_trace});
+
+        if (m_responses.size() == 1)
+        {
+            do_write();
+        }
+    }
+
+    void do_write()
+    {
+        bool keep_alive = http_session::keep_alive(m_responses.front().response);
+
+        if (m_tracer)
+        {
+            m_responses.front().trace.mark(request_trace::write_started);
+        }
+
+        m_wheel.expires_after(*this, m_write_deadline, m_config->connection_timeout);
+
+        // The headers are written like any other response, then the file is sent after them
+        if (auto* file = std::get_if<file_response>(&m_responses.front().response))
+        {
+            http::async_write(
+                m_stream,
+                file->header,
+                beast::bind_front_handler(&http_session::on_write_file_header, this->shared_from_this(), keep_alive));
+            return;
+        }
+
+        // Already serialized, and shared with other connections
+        if (auto* cached = std::get_if<std::shared_ptr<const cached_response>>(&m_responses.front().response))
         {
-            m_socket_error_handler(err);
+            net::async_write(m_stream,
+                             net::buffer((*cached)->bytes),
+                             beast::bind_front_handler(&http_session::on_write_cached, this->shared_from_this(), keep_alive));
             return;
         }
 
-        // Send the response
-        send_response(m_router->handle_request(http_request {std::move(m_request)}));
+        write_generator(keep_alive);
     }
 
-    void send_response(http::message_generator&& msg)
+    // Written a buffer sequence at a time, as `beast::async_write` would, so that its status
+    // line can be seen on the way
+    void write_generator(bool keep_alive)
     {
-        bool keep_alive = msg.keep_alive();
+        auto& queued = m_responses.front();
+        auto& generator = std::get<http::message_generator>(queued.response);
+        if (generator.is_done())
+        {
+            return on_write(keep_alive, {}, 0);
+        }
+
+        beast::error_code err;
+        const auto buffers = generator.prepare(err);
+        if (err)
+        {
+            return on_write(keep_alive, err, 0);
+        }
+
+        if ((m_metrics || m_tracer) && queued.status == 0)
+        {
+            queued.status = status_of(buffers);
+        }
 
-        // Write the response
-        beast::async_write(
+        net::async_write(
             m_stream,
-            std::move(msg),
-            beast::bind_front_handler(&http_session::on_write, shared_from_this(), keep_alive));
+            buffers,
+            beast::bind_front_handler(&http_session::on_write_generator, this->shared_from_this(), keep_alive));
+    }
+
+    void on_write_generator(bool keep_alive, beast::error_code err, std::size_t bytes_transferred)
+    {
+        if (err)
+        {
+            return on_write(keep_alive, err, bytes_transferred);
+        }
+
+        count_sent(bytes_transferred);
+        std::get<http::message_generator>(m_responses.front().response).consume(bytes_transferred);
+        write_generator(keep_alive);
+    }
+
+    void on_write_file_header(bool keep_alive, beast::error_code err, std::size_t bytes_transferred)
+    {
+        count_sent(bytes_transferred);
+
+        if (err || not std::get<file_response>(m_responses.front().response).file)
+        {
+            return on_write(keep_alive, err, bytes_transferred);
+        }
+
+        m_file_offset = 0;
+        send_file(keep_alive);
+    }
+
+    void send_file(bool keep_alive)
+    {
+#if defined(__linux__)
+        if constexpr (is_socket)
+        {
+            return send_file_in_kernel(keep_alive);
+        }
+#endif
+
+        copy_file(keep_alive);
+    }
+
+#if defined(__linux__)
+    // Copy the file to the socket in the kernel, without reading it into memory first
+    void send_file_in_kernel(bool keep_alive)
+    {
+        const auto& file = *std::get<file_response>(m_responses.front().response).file;
+        auto& socket = m_stream.socket();
+
+        beast::error_code err;
+        socket.native_non_blocking(true, err);
+        if (err)
+        {
+            return on_write(keep_alive, err, 0);
+        }
+
+        while (m_file_offset < file.size)
+        {
+            auto offset = static_cast<off_t>(m_file_offset);
+            const auto sent = ::sendfile(socket.native_handle(), file.fd, &offset, file.size - m_file_offset);
+
+            if (sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                // a large file only times out if the client stops taking it
+                m_wheel.expires_after(*this, m_write_deadline, m_config->connection_timeout);
+
+                socket.async_wait(
+                    tcp::socket::wait_write,
+                    beast::bind_front_handler(&http_session::on_socket_writable, this->shared_from_this(), keep_alive));
+                return;
+            }
+
+            // the file got shorter than its Content-Length since it was opened
+            if (sent <= 0)
+            {
+                return on_write(keep_alive, {sent < 0 ? errno : EIO, beast::system_category()}, 0);
+            }
+
+            m_file_offset = static_cast<uint64_t>(offset);
+            count_sent(static_cast<uint64_t>(sent));
+        }
+
+        on_write(keep_alive, {}, file.size);
+    }
+
+    void on_socket_writable(bool keep_alive, beast::error_code err)
+    {
+        if (err)
+        {
+            return on_write(keep_alive, err, 0);
+        }
+
+        send_file_in_kernel(keep_alive);
+    }
+#endif
+
+    // Without `sendfile`, or a socket, the file is read a chunk at a time. Not from the arena,
+    // as the next request may be read into that while the file is sent
+    void copy_file(bool keep_alive)
+    {
+        const auto& file = *std::get<file_response>(m_responses.front().response).file;
+        if (m_file_offset == file.size)
+        {
+            return on_write(keep_alive, {}, file.size);
+        }
+
+        m_file_buffer.resize(std::min<uint64_t>(m_config->stream_chunk_size, file.size - m_file_offset));
+
+        beast::error_code err;
+        const auto count = file.read(m_file_offset, m_file_buffer.data(), m_file_buffer.size(), err);
+
+        // the file got shorter than its Content-Length since it was opened
+        if (err || count == 0)
+        {
+            const auto short_read = boost::system::errc::make_error_code(boost::system::errc::io_error);
+            return on_write(keep_alive, err ? err : short_read, 0);
+        }
+
+        m_file_offset += count;
+        m_wheel.expires_after(*this, m_write_deadline, m_config->connection_timeout);
+
+        net::async_write(
+            m_stream,
+            net::buffer(m_file_buffer.data(), count),
+            beast::bind_front_handler(&http_session::on_file_chunk_written, this->shared_from_this(), keep_alive));
+    }
+
+    void on_file_chunk_written(bool keep_alive, beast::error_code err, std::size_t bytes_transferred)
+    {
+        if (err)
+        {
+            return on_write(keep_alive, err, bytes_transferred);
+        }
+
+        count_sent(bytes_transferred);
+
+        copy_file(keep_alive);
+    }
+
+    void on_write_cached(bool keep_alive, beast::error_code err, std::size_t bytes_transferred)
+    {
+        count_sent(bytes_transferred);
+        on_write(keep_alive, err, bytes_transferred);
     }
 
     void on_write(bool keep_alive, beast::error_code err, std::size_t bytes_transferred)
@@ -102,10 +850,12 @@ class http_session : public std::enable_shared_from_this<http_session>
 
         if (err)
         {
-            m_socket_error_handler(err);
+            m_socket_error_handler(m_timed_out ? beast::error::timeout : err);
             return;
         }
 
+        record(m_responses.front());
+
         if (!keep_alive)
         {
             // This means we should close the connection, usually because
@@ -113,15 +863,136 @@ class http_session : public std::enable_shared_from_this<http_session>
             return do_close();
         }
 
-        // Read another request
-        do_read();
+        m_responses.pop();
+
+        // Resume reading as soon as a full queue has room again, rather than once it is empty
+        if (not m_reading && not m_closing && m_responses.size() < m_config->pipeline_depth)
+        {
+            do_read();
+        }
+
+        if (not m_responses.empty())
+        {
+            return do_write();
+        }
+
+        timer_wheel::cancel(m_write_deadline);
+
+        if (m_closing)
+        {
+            return do_close();
+        }
+    }
+
+    void count_received(uint64_t bytes)
+    {
+        if (m_metrics)
+        {
+            m_metrics->received(bytes);
+        }
+    }
+
+    void count_sent(uint64_t bytes)
+    {
+        if (m_metrics)
+        {
+            m_metrics->sent(bytes);
+        }
+    }
+
+    // The status from the start of a serialized response, e.g. 200 for "HTTP/1.1 200 OK"
+    template<typename Buffers>
+    static auto status_of(const Buffers& buffers) -> unsigned
+    {
+        constexpr size_t status_offset = 9;
+
+        std::array<char, status_offset + 3> line {};
+        if (net::buffer_copy(net::buffer(line), buffers) < line.size())
+        {
+            return 0;
+        }
+
+        unsigned status = 0;
+        std::from_chars(line.data() + status_offset, line.data() + line.size(), status);
+        return status;
+    }
+
+    static auto status_of(const queued_response& queued) -> unsigned
+    {
+        if (const auto* file = std::get_if<file_response>(&queued.response))
+        {
+            return file->header.result_int();
+        }
+
+        if (const auto* cached = std::get_if<std::shared_ptr<const cached_response>>(&queued.response))
+        {
+            return status_of(net::buffer((*cached)->bytes));
+        }
+
+        return queued.status;
+    }
+
+    // Once its response has been written in full
+    void record(queued_response& queued)
+    {
+        if ((not m_metrics && not m_tracer) || queued.start == std::chrono::steady_clock::time_point {})
+        {
+            return;
+        }
+
+        // "100 Continue" is written ahead of the response to the same request
+        const auto status = status_of(queued);
+        if (status < 200)
+        {
+            return;
+        }
+
+        if (m_metrics)
+        {
+            m_metrics->record(queued.route, status, std::chrono::steady_clock::now() - queued.start);
+        }
+
+        if (m_tracer)
+        {
+            queued.trace.mark(request_trace::written);
+            m_tracer->record(queued.route, status, queued.trace);
+        }
+    }
+
+    // Called from the wheel, so the deadlines are looked at again on the connection's executor,
+    // in case they were moved since
+    void on_deadline()
+    {
+        net::post(m_stream.get_executor(),
+                  beast::bind_front_handler(&http_session::check_deadlines, this->shared_from_this()));
+    }
+
+    void check_deadlines()
+    {
+        if (not m_wheel.expired(m_read_deadline) && not m_wheel.expired(m_write_deadline))
+        {
+            m_wheel.schedule(*this, m_read_deadline);
+            m_wheel.schedule(*this, m_write_deadline);
+            return;
+        }
+
+        // Whatever is waiting on the socket fails, and reports the timeout
+        m_timed_out = true;
+        m_stream.close();
     }
 
     void do_close()
     {
-        // Send a TCP shutdown
-        beast::error_code err;
-        m_stream.socket().shutdown(tcp::socket::shutdown_send, err);
+        if constexpr (is_socket)
+        {
+            // Send a TCP shutdown
+            beast::error_code err;
+            m_stream.socket().shutdown(tcp::socket::shutdown_send, err);
+        }
+        else
+        {
+            m_stream.close();
+        }
 
         // At this point the connection is closed gracefully
     }
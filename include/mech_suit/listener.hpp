@@ -1,8 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
+#include <string>
 #include <utility>
 
 #include "mech_suit/boost.hpp"
+#include "mech_suit/connection_limit.hpp"
 #include "mech_suit/error_handlers.hpp"
 #include "mech_suit/http_session.hpp"
 #include "mech_suit/router.hpp"
@@ -10,21 +14,53 @@
 
 namespace mech_suit::detail
 {
-class listener : public std::enable_shared_from_this<listener>
+#if defined(SO_REUSEPORT)
+// Lets every thread bind its own acceptor to the same port, with the kernel spreading connections between them
+using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// Whether accepting failed for want of descriptors or memory, which only time frees up
+inline auto is_out_of_resources(beast::error_code err) -> bool
+{
+    return err == net::error::no_descriptors || err == boost::system::errc::too_many_files_open_in_system
+        || err == net::error::no_buffer_space || err == net::error::no_memory;
+}
+
+template<typename Router>
+class listener : public std::enable_shared_from_this<listener<Router>>
 {
     std::shared_ptr<config> m_config;
     net::io_context& m_ioc;
     tcp::acceptor m_acceptor;
-    std::shared_ptr<const router> m_router;
+    std::shared_ptr<const Router> m_router;
     socket_error_handler_t m_socket_error_handler;
+    std::shared_ptr<connection_limit> m_connections;
+
+    // Written as is to connections over the limit
+    std::string m_overloaded_response;
+
+    // How long accepting is paused for while out of descriptors. Doubles while it lasts
+    static constexpr auto min_backoff = std::chrono::milliseconds(10);
+    static constexpr auto max_backoff = std::chrono::seconds(1);
+    std::chrono::milliseconds m_backoff = min_backoff;
+    net::steady_timer m_backoff_timer;
 
   public:
-    listener(std::shared_ptr<config> conf, net::io_context& ioc, std::shared_ptr<const router> router, socket_error_handler_t socket_error_handler)
-    : m_config(std::move(conf))
+    listener(std::shared_ptr<config> conf,
+             net::io_context& ioc,
+             std::shared_ptr<const Router> router,
+             socket_error_handler_t socket_error_handler,
+             std::shared_ptr<connection_limit> connections)
+        : m_config(std::move(conf))
         , m_ioc(ioc)
-        , m_acceptor(net::make_strand(ioc))
+        , m_acceptor(connection_executor())
         , m_router(std::move(router))
         , m_socket_error_handler(std::move(socket_error_handler))
+        , m_connections(std::move(connections))
+        , m_overloaded_response("HTTP/1.1 503 Service Unavailable\r\nRetry-After: "
+                                + std::to_string(m_config->retry_after.count())
+                                + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n")
+        , m_backoff_timer(m_acceptor.get_executor())
     {
         auto addr = net::ip::make_address(m_config->address);
         tcp::endpoint endpoint {addr, m_config->port};
@@ -45,6 +81,19 @@ class listener : public std::enable_shared_from_this<listener>
             throw std::runtime_error("Unable to set option on acceptor: " + err.message());
         }
 
+        if (m_config->thread_per_core)
+        {
+#if defined(SO_REUSEPORT)
+            m_acceptor.set_option(reuse_port(true), err);
+#else
+            err = net::error::operation_not_supported;
+#endif
+            if (err)
+            {
+                throw std::runtime_error("Unable to set SO_REUSEPORT on acceptor: " + err.message());
+            }
+        }
+
         // Bind to the server address
         m_acceptor.bind(endpoint, err);
         if (err)
@@ -64,26 +113,93 @@ class listener : public std::enable_shared_from_this<listener>
     void run() { do_accept(); }
 
   private:
+    // A connection gets its own strand, unless the `io_context` is only ever run by one thread
+    auto connection_executor() -> net::any_io_executor
+    {
+        if (m_config->thread_per_core)
+        {
+            return m_ioc.get_executor();
+        }
+
+        return net::make_strand(m_ioc);
+    }
+
     void do_accept()
     {
-        // The new connection gets its own strand
-        m_acceptor.async_accept(net::make_strand(m_ioc),
-                                beast::bind_front_handler(&listener::on_accept, shared_from_this()));
+        m_acceptor.async_accept(connection_executor(),
+                                beast::bind_front_handler(&listener::on_accept, this->shared_from_this()));
     }
 
     void on_accept(beast::error_code err, tcp::socket socket)
     {
+        // The acceptor was closed
+        if (err == net::error::operation_aborted)
+        {
+            return;
+        }
+
         if (err)
         {
-            throw std::runtime_error("Error in listener" + err.message());
+            m_socket_error_handler(err);
+
+            // Accepting again straight away would only fail again, so wait for connections to close
+            if (is_out_of_resources(err))
+            {
+                return pause_accepting();
+            }
+
+            return do_accept();
+        }
+
+        m_backoff = min_backoff;
+
+        auto slot = m_connections->try_acquire();
+        if (not slot)
+        {
+            if (auto* metrics = m_router->get_metrics())
+            {
+                metrics->connection_shed();
+            }
+
+            shed(socket);
+            return do_accept();
         }
 
         // Create the session and run it
-        std::make_shared<http_session>(m_config, std::move(socket), m_router, m_socket_error_handler)->run();
+        std::make_shared<http_session<Router>>(
+            m_config, beast::tcp_stream(std::move(socket)), m_router, m_socket_error_handler, std::move(*slot))
+            ->run();
 
         // Accept another connection
         do_accept();
     }
+
+    void pause_accepting()
+    {
+        m_backoff_timer.expires_after(m_backoff);
+        m_backoff = std::min<std::chrono::milliseconds>(m_backoff * 2, max_backoff);
+
+        m_backoff_timer.async_wait(
+            [self = this->shared_from_this()](beast::error_code err)
+            {
+                if (not err)
+                {
+                    self->do_accept();
+                }
+            });
+    }
+
+    // Turn away a connection over the limit with as little work as possible: one write, which
+    // fits in the empty send buffer of a new socket, and no read. A client whose request arrives
+    // after the close may get a reset instead, which is no worse than being refused
+    void shed(tcp::socket& socket)
+    {
+        beast::error_code err;
+        socket.non_blocking(true, err);
+        socket.write_some(net::buffer(m_overloaded_response), err);
+        socket.shutdown(tcp::socket::shutdown_send, err);
+        socket.close(err);
+    }
 };
 
 }  // namespace mech_suit::detail
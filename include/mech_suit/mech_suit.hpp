@@ -1,3 +1,4 @@
 #pragma once
 
 #include "mech_suit/application.hpp"
+#include "mech_suit/memory_stream.hpp"
@@ -0,0 +1,116 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit::detail
+{
+inline constexpr std::string_view json_media_type = "application/json";
+
+// glaze's binary format
+inline constexpr std::string_view beve_media_type = "application/beve";
+
+inline auto trim(std::string_view str) -> std::string_view
+{
+    const auto begin = str.find_first_not_of(" \t");
+    if (begin == std::string_view::npos)
+    {
+        return {};
+    }
+
+    return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+}
+
+// `content_type` without its parameters, e.g. "application/json" for "application/json; charset=utf-8"
+inline auto media_type(std::string_view content_type) -> std::string_view
+{
+    return trim(content_type.substr(0, content_type.find(';')));
+}
+
+inline auto is_beve(std::string_view content_type) -> bool
+{
+    return beast::iequals(media_type(content_type), beve_media_type);
+}
+
+// "application/json", or a type with the "+json" suffix such as "application/problem+json"
+inline auto is_json(std::string_view content_type) -> bool
+{
+    constexpr std::string_view suffix = "+json";
+
+    const auto type = media_type(content_type);
+    return beast::iequals(type, json_media_type)
+        || (type.size() > suffix.size() && beast::iequals(type.substr(type.size() - suffix.size()), suffix));
+}
+
+// The "q" parameter of a media range in an Accept header, from 0 to 1000
+inline auto quality(std::string_view range) -> int
+{
+    constexpr int max_quality = 1000;
+
+    auto params = range.substr(std::min(range.find(';'), range.size()));
+    while (not params.empty())
+    {
+        params.remove_prefix(1);
+        const auto param = trim(params.substr(0, params.find(';')));
+        params.remove_prefix(std::min(params.find(';'), params.size()));
+
+        if (param.size() < 2 || (param[0] != 'q' && param[0] != 'Q') || param[1] != '=')
+        {
+            continue;
+        }
+
+        // "0", "0.5", "1" or "1.000", read as thousandths
+        const auto value = param.substr(2);
+        int whole = 0;
+        const auto [ptr, err] = std::from_chars(value.data(), value.data() + value.size(), whole);
+        if (err != std::errc {} || whole < 0)
+        {
+            return 0;
+        }
+
+        const auto* const end = value.data() + value.size();
+        const auto* digit = ptr != end && *ptr == '.' ? ptr + 1 : ptr;
+
+        int thousandths = std::min(whole, 1) * max_quality;
+        for (int scale = max_quality / 10; digit != end && *digit >= '0' && *digit <= '9' && scale > 0; digit++)
+        {
+            thousandths += (*digit - '0') * scale;
+            scale /= 10;
+        }
+
+        return std::min(thousandths, max_quality);
+    }
+
+    return max_quality;
+}
+
+// Whether a client sending `accept` would rather have BEVE than JSON.
+// JSON wins a tie, and is what a wildcard is taken to mean
+inline auto prefers_beve(std::string_view accept) -> bool
+{
+    int json = accept.empty() ? 1 : 0;
+    int beve = 0;
+
+    while (not accept.empty())
+    {
+        const auto range = accept.substr(0, accept.find(','));
+        accept.remove_prefix(std::min(range.size() + 1, accept.size()));
+
+        const auto type = media_type(range);
+        const auto q = quality(range);
+
+        if (beast::iequals(type, beve_media_type))
+        {
+            beve = std::max(beve, q);
+        }
+        else if (beast::iequals(type, json_media_type) || type == "application/*" || type == "*/*")
+        {
+            json = std::max(json, q);
+        }
+    }
+
+    return beve > json;
+}
+}  // namespace mech_suit::detail
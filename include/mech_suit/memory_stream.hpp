@@ -0,0 +1,210 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit
+{
+// One end of a connection held in memory, to run a session without a socket, e.g. from
+// `auto [client, server] = memory_stream::pair(ioc.get_executor())`. What is written to one end
+// is read from the other without going through the kernel, so its timings only depend on the
+// code that runs. Both ends have to be used from the same thread, or strand
+class memory_stream
+{
+  public:
+    using executor_type = net::any_io_executor;
+
+  private:
+    // The bytes going one way
+    struct pipe
+    {
+        beast::flat_buffer buffer;
+
+        // Never expires. Cancelled to wake the read waiting on it
+        net::steady_timer readable;
+
+        // Closed by the end writing to it, so a read ends once it is empty
+        bool write_closed = false;
+
+        // Closed by the end reading from it, so a write fails
+        bool read_closed = false;
+
+        explicit pipe(const executor_type& executor)
+            : readable(executor, net::steady_timer::time_point::max())
+        {
+        }
+    };
+
+    struct state
+    {
+        executor_type executor;
+        std::array<pipe, 2> pipes;
+
+        explicit state(const executor_type& exec)
+            : executor(exec)
+            , pipes {pipe {exec}, pipe {exec}}
+        {
+        }
+    };
+
+    std::shared_ptr<state> m_state;
+
+    // The pipe this end reads from. It writes to the other
+    size_t m_side = 0;
+
+    memory_stream(std::shared_ptr<state> shared, size_t side)
+        : m_state(std::move(shared))
+        , m_side(side)
+    {
+    }
+
+    template<typename MutableBuffers>
+    struct read_op
+    {
+        std::shared_ptr<state> shared;
+        size_t side;
+        MutableBuffers buffers;
+        bool waited = false;
+
+        template<typename Self>
+        void operator()(Self& self, beast::error_code /*err*/ = {})
+        {
+            auto& from = shared->pipes[side];
+            const bool ready = from.read_closed || from.write_closed || from.buffer.size() != 0
+                || beast::buffer_bytes(buffers) == 0;
+
+            if (not ready)
+            {
+                waited = true;
+                return from.readable.async_wait(std::move(self));
+            }
+
+            // never completed from within `async_read_some`
+            if (not waited)
+            {
+                waited = true;
+                return net::post(std::move(self));
+            }
+
+            if (from.read_closed)
+            {
+                return self.complete(net::error::operation_aborted, 0);
+            }
+
+            const auto bytes = net::buffer_copy(buffers, from.buffer.data());
+            from.buffer.consume(bytes);
+
+            if (bytes == 0 && beast::buffer_bytes(buffers) != 0)
+            {
+                return self.complete(net::error::eof, 0);
+            }
+
+            self.complete({}, bytes);
+        }
+    };
+
+    template<typename ConstBuffers>
+    struct write_op
+    {
+        std::shared_ptr<state> shared;
+        size_t side;
+        ConstBuffers buffers;
+        bool written = false;
+        beast::error_code result {};
+        size_t bytes = 0;
+
+        template<typename Self>
+        void operator()(Self& self)
+        {
+            if (written)
+            {
+                return self.complete(result, bytes);
+            }
+
+            auto& to = shared->pipes[1 - side];
+            if (to.write_closed)
+            {
+                result = net::error::operation_aborted;
+            }
+            else if (to.read_closed)
+            {
+                result = net::error::broken_pipe;
+            }
+            else
+            {
+                bytes = beast::buffer_bytes(buffers);
+                to.buffer.commit(net::buffer_copy(to.buffer.prepare(bytes), buffers));
+                to.readable.cancel();
+            }
+
+            // never completed from within `async_write_some`
+            written = true;
+            net::post(std::move(self));
+        }
+    };
+
+  public:
+    // Two ends connected to each other
+    static auto pair(const executor_type& executor) -> std::pair<memory_stream, memory_stream>
+    {
+        auto shared = std::make_shared<state>(executor);
+        return {memory_stream {shared, 0}, memory_stream {shared, 1}};
+    }
+
+    memory_stream(const memory_stream&) = delete;
+    auto operator=(const memory_stream&) -> memory_stream& = delete;
+
+    memory_stream(memory_stream&& other) noexcept
+        : m_state(std::move(other.m_state))
+        , m_side(other.m_side)
+    {
+    }
+
+    auto operator=(memory_stream&& other) noexcept -> memory_stream&
+    {
+        close();
+        m_state = std::move(other.m_state);
+        m_side = other.m_side;
+        return *this;
+    }
+
+    ~memory_stream() { close(); }
+
+    [[nodiscard]] auto get_executor() const -> executor_type { return m_state->executor; }
+
+    template<typename MutableBuffers, typename Token>
+    auto async_read_some(const MutableBuffers& buffers, Token&& token)
+    {
+        return net::async_compose<Token, void(beast::error_code, size_t)>(
+            read_op<MutableBuffers> {m_state, m_side, buffers}, token, m_state->executor);
+    }
+
+    // Never waits for the other end to read, as the bytes are only copied
+    template<typename ConstBuffers, typename Token>
+    auto async_write_some(const ConstBuffers& buffers, Token&& token)
+    {
+        return net::async_compose<Token, void(beast::error_code, size_t)>(
+            write_op<ConstBuffers> {m_state, m_side, buffers}, token, m_state->executor);
+    }
+
+    // A read waiting on this end fails, and the other end reads what is left then the end of the stream
+    void close()
+    {
+        if (not m_state)
+        {
+            return;
+        }
+
+        auto& in = m_state->pipes[m_side];
+        in.read_closed = true;
+        in.readable.cancel();
+
+        auto& out = m_state->pipes[1 - m_side];
+        out.write_closed = true;
+        out.readable.cancel();
+    }
+};
+}  // namespace mech_suit
@@ -0,0 +1,508 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/http/message_generator.hpp>
+
+#include "mech_suit/boost.hpp"
+#include "mech_suit/http_request.hpp"
+#include "mech_suit/route_label.hpp"
+#include "mech_suit/tracing.hpp"
+
+namespace mech_suit::detail
+{
+// Latencies in microseconds, in four linear buckets per power of two, so that a bucket
+// is never more than a quarter wider than the values in it. Everything from about a minute on
+// is in the last bucket
+struct latency_buckets
+{
+    static constexpr size_t per_octave = 4;
+    static constexpr size_t count = 100;
+
+    static constexpr auto index(uint64_t micros) -> size_t
+    {
+        if (micros < per_octave)
+        {
+            return static_cast<size_t>(micros);
+        }
+
+        const auto octave = static_cast<size_t>(std::bit_width(micros)) - 1;
+        const auto sub = static_cast<size_t>(micros >> (octave - 2)) & (per_octave - 1);
+        return std::min(((octave - 1) * per_octave) + sub, count - 1);
+    }
+
+    // The smallest value in bucket `index`
+    static constexpr auto lower_bound(size_t index) -> uint64_t
+    {
+        if (index < per_octave)
+        {
+            return index;
+        }
+
+        const auto octave = (index / per_octave) + 1;
+        return (per_octave + (index % per_octave)) << (octave - 2);
+    }
+
+    // Values in bucket `index` are below this
+    static constexpr auto upper_bound(size_t index) -> uint64_t { return lower_bound(index + 1); }
+};
+
+// Request counts, latencies and bytes moved, for the Prometheus text format.
+// Every thread counts into its own shard with plain stores, so recording takes no lock and no
+// locked instruction. The shards are only summed when they are asked for
+class metrics
+{
+    // Counted into by one thread, read by any
+    using counter = std::atomic<uint64_t>;
+
+    static void add(counter& value, uint64_t amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    // The latencies of the responses of a route with one status
+    struct status_stats
+    {
+        // 0 while the slot is unused
+        std::atomic<unsigned> status {0};
+        counter sum_micros {0};
+        std::array<counter, latency_buckets::count> buckets {};
+    };
+
+    // Statuses past this many for a route on a thread are counted together, as status "other"
+    static constexpr size_t statuses_per_route = 8;
+
+    struct route_stats
+    {
+        std::array<status_stats, statuses_per_route> statuses {};
+
+        // its status stays 0
+        status_stats other {};
+    };
+
+    struct shard
+    {
+        std::thread::id thread;
+
+        counter connections_opened {0};
+        counter connections_closed {0};
+        counter connections_shed {0};
+        counter bytes_received {0};
+        counter bytes_sent {0};
+
+        // Allocated on a route's first response on the thread
+        std::vector<std::atomic<route_stats*>> routes;
+
+        explicit shard(size_t route_count)
+            : thread(std::this_thread::get_id())
+            , routes(route_count)
+        {
+        }
+
+        shard(const shard&) = delete;
+        shard(shard&&) = delete;
+        auto operator=(const shard&) -> shard& = delete;
+        auto operator=(shard&&) -> shard& = delete;
+
+        ~shard()
+        {
+            for (auto& route : routes)
+            {
+                delete route.load();  // NOLINT(*-owning-memory)
+            }
+        }
+    };
+
+    // Tells the shards of different instances apart, even at the same address
+    static inline std::atomic<uint64_t> s_next_instance {1};
+    const uint64_t m_instance = s_next_instance.fetch_add(1);
+
+    // The shard of the calling thread, for the instance it was last looked up for
+    static inline thread_local uint64_t t_instance = 0;
+    static inline thread_local shard* t_shard = nullptr;
+
+    // the declared routes, then these
+    size_t m_route_count = 0;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<shard>> m_shards;
+
+    auto local() -> shard&
+    {
+        if (t_instance == m_instance)
+        {
+            return *t_shard;
+        }
+
+        const std::lock_guard lock {m_mutex};
+
+        auto iter = std::find_if(m_shards.begin(),
+                                 m_shards.end(),
+                                 [](const auto& item) { return item->thread == std::this_thread::get_id(); });
+        if (iter == m_shards.end())
+        {
+            m_shards.push_back(std::make_unique<shard>(m_route_count + special_routes));
+            iter = std::prev(m_shards.end());
+        }
+
+        t_instance = m_instance;
+        t_shard = iter->get();
+        return **iter;
+    }
+
+    static auto find_status(route_stats& stats, unsigned status) -> status_stats&
+    {
+        for (auto& slot : stats.statuses)
+        {
+            const auto current = slot.status.load(std::memory_order_relaxed);
+            if (current == status)
+            {
+                return slot;
+            }
+
+            if (current == 0)
+            {
+                slot.status.store(status, std::memory_order_release);
+                return slot;
+            }
+        }
+
+        return stats.other;
+    }
+
+  public:
+    // Ids after the declared routes, for responses that didn't come from one
+    static constexpr size_t special_routes = 4;
+    enum special_route : size_t
+    {
+        static_files_route,
+        metrics_route,
+        traces_route,
+        unmatched_route,
+    };
+
+    explicit metrics(size_t route_count)
+        : m_route_count(route_count)
+    {
+    }
+
+    [[nodiscard]] auto route_id(special_route route) const -> size_t { return m_route_count + route; }
+
+    void connection_opened() { add(local().connections_opened, 1); }
+    void connection_closed() { add(local().connections_closed, 1); }
+    void connection_shed() { add(local().connections_shed, 1); }
+    void received(uint64_t bytes) { add(local().bytes_received, bytes); }
+    void sent(uint64_t bytes) { add(local().bytes_sent, bytes); }
+
+    void record(size_t route, unsigned status, std::chrono::steady_clock::duration latency)
+    {
+        auto& local = this->local();
+        if (route >= local.routes.size())
+        {
+            route = route_id(unmatched_route);
+        }
+
+        auto* stats = local.routes[route].load(std::memory_order_relaxed);
+        if (stats == nullptr)
+        {
+            stats = new route_stats {};  // NOLINT(*-owning-memory)
+            local.routes[route].store(stats, std::memory_order_release);
+        }
+
+        const auto micros =
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+
+        auto& slot = find_status(*stats, status);
+        add(slot.buckets[latency_buckets::index(micros)], 1);
+        add(slot.sum_micros, micros);
+    }
+
+    // Everything counted so far in the Prometheus text format. `labels` are those of every route id
+    auto text(std::span<const route_label> labels) -> std::string
+    {
+        struct totals
+        {
+            uint64_t sum_micros = 0;
+            std::array<uint64_t, latency_buckets::count> buckets {};
+        };
+
+        std::vector<std::vector<std::pair<unsigned, totals>>> routes(m_route_count + special_routes);
+        uint64_t opened = 0;
+        uint64_t closed = 0;
+        uint64_t shed = 0;
+        uint64_t received = 0;
+        uint64_t sent = 0;
+
+        {
+            const std::lock_guard lock {m_mutex};
+            for (const auto& thread_shard : m_shards)
+            {
+                opened += thread_shard->connections_opened.load(std::memory_order_relaxed);
+                closed += thread_shard->connections_closed.load(std::memory_order_relaxed);
+                shed += thread_shard->connections_shed.load(std::memory_order_relaxed);
+                received += thread_shard->bytes_received.load(std::memory_order_relaxed);
+                sent += thread_shard->bytes_sent.load(std::memory_order_relaxed);
+
+                for (size_t route = 0; route < thread_shard->routes.size(); route++)
+                {
+                    const auto* stats = thread_shard->routes[route].load(std::memory_order_acquire);
+                    if (stats == nullptr)
+                    {
+                        continue;
+                    }
+
+                    // 0 for the statuses counted as "other"
+                    const auto merge = [&](unsigned status, const status_stats& slot)
+                    {
+                        auto& statuses = routes[route];
+                        auto iter = std::find_if(
+                            statuses.begin(), statuses.end(), [&](const auto& item) { return item.first == status; });
+                        if (iter == statuses.end())
+                        {
+                            statuses.emplace_back(status, totals {});
+                            iter = std::prev(statuses.end());
+                        }
+
+                        iter->second.sum_micros += slot.sum_micros.load(std::memory_order_relaxed);
+                        for (size_t i = 0; i < latency_buckets::count; i++)
+                        {
+                            iter->second.buckets[i] += slot.buckets[i].load(std::memory_order_relaxed);
+                        }
+                    };
+
+                    for (const auto& slot : stats->statuses)
+                    {
+                        const auto status = slot.status.load(std::memory_order_acquire);
+                        if (status == 0)
+                        {
+                            break;
+                        }
+
+                        merge(status, slot);
+                    }
+
+                    // only once a response has been counted in it
+                    const auto& other = stats->other.buckets;
+                    if (std::any_of(other.begin(),
+                                    other.end(),
+                                    [](const counter& value) { return value.load(std::memory_order_relaxed) != 0; }))
+                    {
+                        merge(0, stats->other);
+                    }
+                }
+            }
+        }
+
+        std::string out;
+        const auto seconds = [](uint64_t micros) { return std::to_string(static_cast<double>(micros) / 1e6); };
+
+        out += "# HELP mech_suit_request_duration_seconds From the headers of a request being read to its response "
+               "being written\n";
+        out += "# TYPE mech_suit_request_duration_seconds histogram\n";
+        for (size_t route = 0; route < routes.size(); route++)
+        {
+            std::string_view method;
+            std::string_view path;
+            if (route < labels.size() && labels[route].method != http::verb::unknown)
+            {
+                method = http::to_string(labels[route].method);
+                path = labels[route].path;
+            }
+
+            for (const auto& [status, totals] : routes[route])
+            {
+                std::string series = "method=\"" + std::string(method) + "\",route=\"";
+                for (const auto chr : path)
+                {
+                    if (chr == '"' || chr == '\\')
+                    {
+                        series += '\\';
+                    }
+                    series += chr;
+                }
+                series += "\",status=\"" + (status == 0 ? std::string("other") : std::to_string(status)) + "\"";
+
+                uint64_t count = 0;
+                for (size_t i = 0; i + 1 < latency_buckets::count; i++)
+                {
+                    count += totals.buckets[i];
+                    out += "mech_suit_request_duration_seconds_bucket{" + series + ",le=\""
+                        + seconds(latency_buckets::upper_bound(i)) + "\"} " + std::to_string(count) + '\n';
+                }
+                count += totals.buckets.back();
+
+                out += "mech_suit_request_duration_seconds_bucket{" + series + ",le=\"+Inf\"} " + std::to_string(count)
+                    + '\n';
+                out += "mech_suit_request_duration_seconds_sum{" + series + "} " + seconds(totals.sum_micros) + '\n';
+                out += "mech_suit_request_duration_seconds_count{" + series + "} " + std::to_string(count) + '\n';
+            }
+        }
+
+        const auto single = [&](std::string_view name, std::string_view type, std::string_view help, uint64_t value)
+        {
+            out += "# HELP " + std::string(name) + ' ' + std::string(help) + '\n';
+            out += "# TYPE " + std::string(name) + ' ' + std::string(type) + '\n';
+            out += std::string(name) + ' ' + std::to_string(value) + '\n';
+        };
+
+        single("mech_suit_connections", "gauge", "Connections open now", opened - std::min(opened, closed));
+        single("mech_suit_connections_total", "counter", "Connections accepted", opened);
+        single("mech_suit_connections_shed_total", "counter", "Connections turned away over the limit", shed);
+        single("mech_suit_received_bytes_total", "counter", "Bytes of requests read", received);
+        single("mech_suit_sent_bytes_total", "counter", "Bytes of responses written", sent);
+
+        return out;
+    }
+};
+
+// Serves the metrics and the slowest traced requests of a router at paths of their own,
+// for requests that no route matched
+class metrics_server
+{
+    std::string m_metrics_path;
+    std::unique_ptr<metrics> m_metrics;
+
+    std::string m_traces_path;
+    size_t m_trace_capacity = 0;
+    std::unique_ptr<tracer> m_tracer;
+
+    // Of the declared routes
+    size_t m_route_count = 0;
+
+    // Requests dumped when the query doesn't ask for a number
+    static constexpr size_t default_slowest = 20;
+
+    // The labels of every route id. `labels` are those of the declared routes
+    auto all_labels(std::span<const route_label> labels) const -> std::vector<route_label>
+    {
+        std::vector<route_label> all(labels.begin(), labels.end());
+        all.push_back({http::verb::get, "static"});
+        all.push_back({http::verb::get, m_metrics_path});
+        all.push_back({http::verb::get, m_traces_path});
+        all.push_back({http::verb::unknown, ""});
+        return all;
+    }
+
+    static auto text_response(const http_request& request, std::string_view content_type, std::string body)
+        -> http::message_generator
+    {
+        http::response<http::string_body> response {http::status::ok, request.beast_request.version()};
+        response.set(http::field::content_type, content_type);
+        response.keep_alive(request.beast_request.keep_alive());
+        if (request.beast_request.method() != http::verb::head)
+        {
+            response.body() = std::move(body);
+        }
+        response.prepare_payload();
+        return response;
+    }
+
+    // The value of `name` in the query of `request`, e.g. "10" for "slowest" in "?slowest=10"
+    static auto query_value(const http_request& request, std::string_view name) -> std::string_view
+    {
+        auto query = request.query.empty() ? request.query : request.query.substr(1);
+        while (not query.empty())
+        {
+            const auto param = query.substr(0, query.find('&'));
+            query.remove_prefix(std::min(param.size() + 1, query.size()));
+
+            const auto equals = param.find('=');
+            if (param.substr(0, equals) == name)
+            {
+                return equals == std::string_view::npos ? std::string_view() : param.substr(equals + 1);
+            }
+        }
+
+        return {};
+    }
+
+  protected:
+    auto metrics_response(const http_request& request, std::span<const route_label> labels) const
+        -> std::optional<http::message_generator>
+    {
+        if (not m_metrics || request.path != m_metrics_path)
+        {
+            return std::nullopt;
+        }
+
+        return text_response(request, "text/plain; version=0.0.4", m_metrics->text(all_labels(labels)));
+    }
+
+    // The slowest traced requests, e.g. "?slowest=50", as text or with "&format=chrome" as a Chrome trace
+    auto traces_response(const http_request& request, std::span<const route_label> labels) const
+        -> std::optional<http::message_generator>
+    {
+        if (not m_tracer || request.path != m_traces_path)
+        {
+            return std::nullopt;
+        }
+
+        size_t count = default_slowest;
+        const auto slowest = query_value(request, "slowest");
+        std::from_chars(slowest.data(), slowest.data() + slowest.size(), count);
+
+        const auto requests = m_tracer->slowest(count);
+        if (query_value(request, "format") == "chrome")
+        {
+            return text_response(request, "application/json", tracer::chrome_trace(requests, all_labels(labels)));
+        }
+
+        return text_response(request, "text/plain", tracer::text(requests, all_labels(labels)));
+    }
+
+  public:
+    // Serve what is counted at `path`, once counting is started
+    void serve_metrics(std::string path) { m_metrics_path = std::move(path); }
+
+    // Trace the last `capacity` requests of each thread, and serve the slowest at `path`,
+    // once counting is started
+    void serve_traces(std::string path, size_t capacity = tracer::default_capacity)
+    {
+        m_traces_path = std::move(path);
+        m_trace_capacity = capacity;
+    }
+
+    // Start counting and tracing, for what is served, now that there are `route_count` routes
+    void start_metrics(size_t route_count)
+    {
+        m_route_count = route_count;
+
+        if (not m_metrics_path.empty() && not m_metrics)
+        {
+            m_metrics = std::make_unique<metrics>(route_count);
+        }
+
+        if (not m_traces_path.empty() && not m_tracer)
+        {
+            m_tracer = std::make_unique<tracer>(m_trace_capacity);
+        }
+    }
+
+    // Nothing unless metrics are served, so nothing is counted for them either
+    [[nodiscard]] auto get_metrics() const -> metrics* { return m_metrics.get(); }
+
+    // Nothing unless traces are served, so no request is traced either
+    [[nodiscard]] auto get_tracer() const -> tracer* { return m_tracer.get(); }
+
+    // What the responses that didn't come from a declared route are counted and traced as
+    [[nodiscard]] auto special_route_id(metrics::special_route route) const -> size_t
+    {
+        return m_route_count + route;
+    }
+};
+}  // namespace mech_suit::detail
@@ -0,0 +1,65 @@
+#pragma once
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <boost/asio/thread_pool.hpp>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit
+{
+namespace detail
+{
+// Posts a function to the pool, then posts what it returned (or threw)
+// back to the executor of the coroutine waiting on it
+template<typename Result>
+struct run_on_pool
+{
+    net::thread_pool& pool;
+
+    template<typename Handler, typename Func>
+    void operator()(Handler&& handler, Func&& func) const
+    {
+        // keep the waiting side's `io_context` running until the result is back
+        auto executor = net::prefer(net::get_associated_executor(handler), net::execution::outstanding_work.tracked);
+
+        net::post(pool,
+                  [handler = std::forward<Handler>(handler),
+                   func = std::forward<Func>(func),
+                   executor = std::move(executor)]() mutable
+                  {
+                      std::exception_ptr except;
+                      std::optional<Result> result;
+                      try
+                      {
+                          result.emplace(func());
+                      }
+                      catch (...)
+                      {
+                          except = std::current_exception();
+                      }
+
+                      net::post(executor,
+                                [handler = std::move(handler), except, result = std::move(result)]() mutable
+                                { std::move(handler)(except, std::move(result)); });
+                  });
+    }
+};
+}  // namespace detail
+
+// Run `func` on `pool` and resume the awaiting coroutine on its own executor with the result.
+// For CPU heavy work that would otherwise hold up the connections of an I/O thread
+template<typename Func>
+auto run_on(net::thread_pool& pool, Func func) -> net::awaitable<std::invoke_result_t<Func&>>
+{
+    using result_t = std::invoke_result_t<Func&>;
+
+    auto result =
+        co_await net::async_initiate<const net::use_awaitable_t<>, void(std::exception_ptr, std::optional<result_t>)>(
+            detail::run_on_pool<result_t> {pool}, net::use_awaitable, std::move(func));
+
+    co_return std::move(*result);
+}
+}  // namespace mech_suit
@@ -1,14 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <charconv>
 #include <cstddef>
-#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string_view>
 #include <type_traits>
 #include <utility>
-#include <variant>
-#include <vector>
 
 #include "mech_suit/common.hpp"
 #include "mech_suit/meta_string.hpp"
@@ -16,33 +15,74 @@
 namespace mech_suit::detail
 {
 
-struct base_path_part
+// Test that a single path part can be parsed as the placeholder type `T`
+template<typename T>
+auto param_matches(std::string_view part) -> bool
 {
-    base_path_part() = default;
-    constexpr base_path_part(const base_path_part&) = default;
-    base_path_part(base_path_part&&) = default;
-    auto operator=(const base_path_part&) -> base_path_part& = default;
-    auto operator=(base_path_part&&) -> base_path_part& = default;
-    virtual ~base_path_part() = default;
-    virtual auto test_path_part(std::string_view part) const -> bool = 0;
+    if constexpr (std::is_same_v<T, std::string_view>)
+    {
+        return true;
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+        constexpr auto valid = std::array<std::string_view, 6> {
+            "yes",
+            "no",
+            "true",
+            "false",
+            "1",
+            "0",
+        };
+        return valid.end() != std::find(valid.begin(), valid.end(), part);
+    }
+    else if constexpr (std::is_arithmetic_v<T>)
+    {
+        // TODO: support negative numbers and floats
+        return !part.empty() && std::all_of(part.begin(), part.end(), ::isdigit);
+    }
+    else
+    {
+        static_assert(0 != sizeof(T), "Path param testing not implemented for type");
+    }
+}
+
+using path_part_matcher_t = bool (*)(std::string_view);
+
+// The deepest path a route can be declared with.
+// Requests are split into a fixed array of this many parts, so routing never allocates
+static constexpr size_t max_path_parts = 32;
+
+using path_parts_t = std::array<std::string_view, max_path_parts>;
+
+// Runtime description of one `/` separated part of a route path.
+// Literal parts carry their text, placeholders carry the matcher for their type
+struct path_segment
+{
+    std::string_view literal;
+    path_part_matcher_t matcher = nullptr;
+
+    // placeholders that accept any input are tried after every other candidate
+    bool catch_all = false;
+
+    constexpr auto is_placeholder() const -> bool { return matcher != nullptr; }
 };
 
 template<meta::string Part, size_t Pos, size_t PartN>
-struct literal_path_part : public base_path_part
+struct literal_path_part
 {
-    literal_path_part() = default;
     static constexpr size_t pos = Pos;
     static constexpr size_t part_n = PartN;
     static constexpr std::string_view part = static_cast<std::string_view>(Part);
+    static constexpr path_segment segment {part};
 
-    auto test_path_part(std::string_view p) const -> bool final
+    static constexpr auto matches(std::string_view p) -> bool
     {
         return p == part;
     }
 };
 
 template<meta::string Path, size_t Pos, typename T, meta::string Name>
-struct path_param : public base_path_part
+struct path_param
 {
   private:
     static constexpr auto count_slashes_until_part() -> size_t
@@ -61,41 +101,16 @@ struct path_param : public base_path_part
     }
 
   public:
-    path_param() = default;
-
-    auto test_path_part(std::string_view part) const -> bool final
+    static auto matches(std::string_view part) -> bool
     {
-        if constexpr (std::is_same_v<T, std::string_view>)
-        {
-            return true;
-        }
-        else if constexpr (std::is_same_v<T, bool>)
-        {
-            constexpr auto valid = std::array<const char*, 6> {
-                "yes",
-                "no",
-                "true",
-                "false",
-                "1",
-                "0",
-            };
-            return valid.end() != std::find(valid.begin(), valid.end(), part);
-        }
-        else if constexpr (std::is_arithmetic_v<T>)
-        {
-            // TODO: support negative numbers and floats
-            return !part.empty() && std::all_of(part.begin(), part.end(), ::isdigit);
-        }
-        else
-        {
-            static_assert(0 != sizeof(T), "Path param testing not implemented for type");
-        }
+        return param_matches<T>(part);
     }
 
     static constexpr size_t pos = Pos;
     static constexpr size_t part_n = count_slashes_until_part();
     using type = T;
     static constexpr auto name = Name;
+    static constexpr path_segment segment {{}, &param_matches<T>, std::is_same_v<T, std::string_view>};
 };
 
 template<char... C>
@@ -213,19 +228,9 @@ class http_params_impl;
 template<typename... Ts>
 class http_params_impl<std::tuple<Ts...>>
 {
-    using variant_t = std::variant<std::nullopt_t, typename Ts::type...>;
-
-    template<size_t... Is>
-    auto parse(std::index_sequence<Is...> /*unused*/, size_t param_index, std::string_view path_part) const -> variant_t
-    {
-        return (...,
-                (param_index == Is ? variant_t {parse_from_str<typename param_type_at_index<Is>::type>(path_part)}
-                                   : variant_t {std::nullopt}));
-    }
-
     // Convert string_view to type T
     template<typename T>
-    auto parse_from_str(std::string_view str) const -> T
+    static auto parse_from_str(std::string_view str) -> T
     {
         if constexpr (std::is_same_v<std::string_view, T>)
         {
@@ -243,12 +248,24 @@ class http_params_impl<std::tuple<Ts...>>
         }
     }
 
+    static constexpr size_t parts_needed = std::max({size_t {0}, (Ts::part_n + 1)...});
+
+    static auto parse(std::span<const std::string_view> parts) -> std::tuple<typename Ts::type...>
+    {
+        // we should only be parsing paths that match, but just incase
+        if (parts.size() < parts_needed) [[unlikely]]
+        {
+            throw std::runtime_error("Failed to parse parameters");
+        }
+
+        return {parse_from_str<typename Ts::type>(parts[Ts::part_n])...};
+    }
+
   public:
     using tuple_t = std::tuple<Ts...>;
 
-    std::vector<variant_t> params {};
+    std::tuple<typename Ts::type...> params;
 
-    static constexpr std::array<size_t, sizeof...(Ts)> part_numbers {Ts::part_n...};
     static constexpr size_t size = std::tuple_size_v<tuple_t>;
 
     template<size_t Idx>
@@ -277,45 +294,10 @@ class http_params_impl<std::tuple<Ts...>>
     template<size_t Idx>
     using param_at_path_idx_t = typename param_at_path_idx<Idx>::type;
 
-    template<typename T = void>
-    explicit http_params_impl(std::string_view /*unused*/)
-    {
-    }
-
-    template<typename T = void>
-        requires(sizeof...(Ts) > 0)
-    explicit http_params_impl(std::string_view path)
+    // `parts` are the parts of the request path, as split by the router when matching
+    explicit http_params_impl(std::span<const std::string_view> parts)
+        : params(parse(parts))
     {
-        if (path.size() <= 1)
-        {
-            return;
-        }
-
-        // skip the first "/"
-        path = path.substr(1);
-
-        for (size_t i = 0, n = 0; n <= part_numbers.back(); n++)
-        {
-            if (n == part_numbers[i])
-            {
-                auto part = path.substr(0, path.find('/'));
-                params.push_back(parse(std::index_sequence_for<Ts...>(), i++, part));
-            }
-
-            auto pos = path.find('/');
-            if (pos == std::string_view::npos || pos + 1 >= path.size())
-            {
-                break;
-            }
-
-            path = path.substr(pos + 1);
-        }
-
-        // we should only be parsing paths that match, but just incase
-        if (params.size() != sizeof...(Ts)) [[unlikely]]
-        {
-            throw std::runtime_error("Failed to parse parameters");
-        }
     }
 };
 
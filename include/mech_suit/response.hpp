@@ -0,0 +1,233 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/http/message_generator.hpp>
+#include <boost/optional.hpp>
+#include <glaze/glaze.hpp>
+
+#include "mech_suit/boost.hpp"
+#include "mech_suit/http_request.hpp"
+#include "mech_suit/media_type.hpp"
+
+namespace mech_suit
+{
+// A value for a callback to return instead of a response, written as the body with glaze
+template<typename T, glz::opts Opts = glz::opts {.format = glz::json}>
+struct glz_response
+{
+    static constexpr glz::opts opts = Opts;
+
+    T value;
+    http::status status = http::status::ok;
+};
+
+template<typename T, glz::opts Opts = glz::opts {.format = glz::json}>
+using json_response = glz_response<T, Opts>;
+
+template<typename T, glz::opts Opts = glz::opts {.format = glz::binary}>
+using binary_response = glz_response<T, Opts>;
+
+// Written as glaze binary for a client that would rather accept "application/beve", otherwise as JSON.
+// A callback can also return the value alone, which is written like this with a 200 status
+template<typename T>
+struct glz_any_response
+{
+    T value;
+    http::status status = http::status::ok;
+};
+
+namespace detail
+{
+// Response bodies left over from earlier responses, kept per thread like the read buffers
+class string_pool
+{
+    static constexpr size_t max_pooled = 64;
+    static constexpr size_t max_pooled_capacity = 64 * 1024;
+
+    static inline thread_local std::vector<std::string> t_strings {};
+
+  public:
+    static auto acquire() -> std::string
+    {
+        if (t_strings.empty())
+        {
+            return {};
+        }
+
+        auto str = std::move(t_strings.back());
+        t_strings.pop_back();
+        return str;
+    }
+
+    // Only a string with memory of its own is worth keeping. An empty or moved-from one
+    // still has the capacity of the buffer inside it, e.g. 15 with libstdc++
+    static void release(std::string&& str)
+    {
+        if (t_strings.size() >= max_pooled || str.capacity() <= std::string {}.capacity()
+            || str.capacity() > max_pooled_capacity)
+        {
+            return;
+        }
+
+        str.clear();
+        t_strings.push_back(std::move(str));
+    }
+};
+
+// A string body taken from the `string_pool`, and given back once the response is done with it
+struct pooled_string_body
+{
+    class value_type
+    {
+        std::string m_str = string_pool::acquire();
+
+      public:
+        value_type() = default;
+        value_type(const value_type&) = delete;
+        auto operator=(const value_type&) -> value_type& = delete;
+        // Leaves `other` with nothing to give back to the pool
+        value_type(value_type&& other) noexcept
+            : m_str(std::exchange(other.m_str, std::string {}))
+        {
+        }
+
+        auto operator=(value_type&& other) noexcept -> value_type&
+        {
+            std::swap(m_str, other.m_str);
+            return *this;
+        }
+
+        ~value_type() { string_pool::release(std::move(m_str)); }
+
+        auto str() -> std::string& { return m_str; }
+        [[nodiscard]] auto str() const -> const std::string& { return m_str; }
+    };
+
+    static auto size(const value_type& body) -> std::uint64_t { return body.str().size(); }
+
+    class writer
+    {
+        const value_type& m_body;
+
+      public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool IsRequest, typename Fields>
+        explicit writer(const http::header<IsRequest, Fields>& /*header*/, const value_type& body)
+            : m_body(body)
+        {
+        }
+
+        void init(beast::error_code& err) { err = {}; }
+
+        auto get(beast::error_code& err) -> boost::optional<std::pair<const_buffers_type, bool>>
+        {
+            err = {};
+            return {{net::const_buffer(m_body.str().data(), m_body.str().size()), false}};
+        }
+    };
+};
+
+// The whole of `response`, status line and headers included
+inline auto serialize(http::message_generator& response) -> std::string
+{
+    std::string bytes;
+    while (not response.is_done())
+    {
+        beast::error_code err;
+        const auto buffers = response.prepare(err);
+        if (err)
+        {
+            throw beast::system_error(err);
+        }
+
+        for (const auto& buffer : buffers)
+        {
+            bytes.append(static_cast<const char*>(buffer.data()), buffer.size());
+        }
+
+        response.consume(net::buffer_size(buffers));
+    }
+
+    return bytes;
+}
+
+template<glz::opts Opts>
+constexpr auto content_type() -> std::string_view
+{
+    return Opts.format == glz::binary ? beve_media_type : json_media_type;
+}
+
+// What a callback returned, as a response to `request`
+template<typename Response>
+    requires(std::is_convertible_v<Response, http::message_generator>)
+auto to_response(const http_request& /*request*/, Response&& response) -> http::message_generator
+{
+    return std::forward<Response>(response);
+}
+
+// Serialized straight into the body, with no copy in between.
+// Throws if `value` can't be serialized, rather than send what was written of it
+template<glz::opts Opts, typename T>
+auto make_glz_response(const http_request& request, const T& value, http::status status)
+    -> http::response<pooled_string_body>
+{
+    http::response<pooled_string_body> message {status, request.beast_request.version()};
+    if (glz::write<Opts>(value, message.body().str()))
+    {
+        throw std::runtime_error("Unable to serialize the response");
+    }
+
+    message.set(http::field::content_type, content_type<Opts>());
+    message.keep_alive(request.beast_request.keep_alive());
+    message.prepare_payload();
+    return message;
+}
+
+// What a callback returned, as a response to `request` that is still its own type, e.g. to compress its body
+template<typename Body, typename Fields>
+auto to_message(const http_request& /*request*/, http::response<Body, Fields>&& response)
+    -> http::response<Body, Fields>
+{
+    return std::move(response);
+}
+
+template<typename T, glz::opts Opts>
+auto to_message(const http_request& request, glz_response<T, Opts>&& response) -> http::response<pooled_string_body>
+{
+    return make_glz_response<Opts>(request, response.value, response.status);
+}
+
+template<typename T>
+auto to_message(const http_request& request, glz_any_response<T>&& response) -> http::response<pooled_string_body>
+{
+    auto message = prefers_beve(request.beast_request[http::field::accept])
+        ? make_glz_response<glz::opts {.format = glz::binary}>(request, response.value, response.status)
+        : make_glz_response<glz::opts {.format = glz::json}>(request, response.value, response.status);
+
+    // the same target can get either format
+    message.set(http::field::vary, "Accept");
+    return message;
+}
+
+template<typename T>
+    requires(not std::is_convertible_v<T, http::message_generator>)
+auto to_message(const http_request& request, T&& value) -> http::response<pooled_string_body>
+{
+    return to_message(request, glz_any_response<std::remove_cvref_t<T>> {std::forward<T>(value)});
+}
+
+template<typename T>
+    requires(not std::is_convertible_v<T, http::message_generator>)
+auto to_response(const http_request& request, T&& value) -> http::message_generator
+{
+    return to_message(request, std::forward<T>(value));
+}
+}  // namespace detail
+}  // namespace mech_suit
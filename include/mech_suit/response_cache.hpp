@@ -0,0 +1,170 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+#include <boost/beast/http/message_generator.hpp>
+
+#include "mech_suit/boost.hpp"
+#include "mech_suit/http_request.hpp"
+#include "mech_suit/response.hpp"
+#include "mech_suit/static_files.hpp"
+
+namespace mech_suit
+{
+// How long, and how many, responses of a cached GET route are kept
+struct cache_options
+{
+    static constexpr size_t default_max_entries = 1024;
+    static constexpr size_t default_max_bytes = 16 * 1024 * 1024;
+
+    std::chrono::milliseconds ttl = std::chrono::seconds(1);
+
+    // distinct targets, i.e. path and query, that are kept at once
+    size_t max_entries = default_max_entries;
+
+    // bytes of every response kept at once. A larger response isn't kept at all
+    size_t max_bytes = default_max_bytes;
+};
+
+namespace detail
+{
+// A whole response, status line and headers included, ready to be written as is.
+// Shared by every connection it is written to
+struct cached_response
+{
+    std::string bytes;
+    bool keep_alive = true;
+};
+
+// What the session writes for a request
+using response_t = std::variant<http::message_generator, file_response, std::shared_ptr<const cached_response>>;
+
+// The serialized responses of a route, keyed on the target of the request
+class response_cache
+{
+    struct entry
+    {
+        std::shared_ptr<const cached_response> response;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    cache_options m_options;
+
+    // The route compresses its responses for the clients that accept it
+    bool m_varies_on_encoding;
+
+    // So that entries can be looked up by a `std::string_view`, without a `std::string` to compare with
+    struct key_hash
+    {
+        using is_transparent = void;
+        auto operator()(std::string_view key) const -> size_t { return std::hash<std::string_view> {}(key); }
+    };
+
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, entry, key_hash, std::equal_to<>> m_entries;
+    size_t m_bytes = 0;
+
+
+    // Only successful responses are kept, so an error doesn't outlive its cause
+    static auto is_cacheable(std::string_view bytes) -> bool
+    {
+        // after "HTTP/1.x "
+        constexpr size_t status_offset = 9;
+        return bytes.size() > status_offset && bytes[status_offset] == '2';
+    }
+
+    void remove_expired(std::chrono::steady_clock::time_point now)
+    {
+        std::erase_if(m_entries,
+                      [&](const auto& item)
+                      {
+                          if (item.second.expires > now)
+                          {
+                              return false;
+                          }
+
+                          m_bytes -= item.second.response->bytes.size();
+                          return true;
+                      });
+    }
+
+  public:
+    explicit response_cache(cache_options options, bool varies_on_encoding = false)
+        : m_options(options)
+        , m_varies_on_encoding(varies_on_encoding)
+    {
+    }
+
+    // What the response to `request` is kept under, written over `key` so that a buffer can be reused.
+    // The same target can get different responses for a different version, when the connection
+    // is closing, or in a different format or encoding
+    void make_key(const http_request& request, std::string& key) const
+    {
+        const auto& req = request.beast_request;
+        key.assign(req.target());
+        key += req.keep_alive() ? '+' : '-';
+        key += std::to_string(req.version());
+        key += '\n';
+        key += req[http::field::accept];
+        if (m_varies_on_encoding)
+        {
+            key += '\n';
+            key += req[http::field::accept_encoding];
+        }
+    }
+
+    // Nothing if there is no response under `key`, or it has expired
+    auto find(std::string_view key) -> std::shared_ptr<const cached_response>
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const std::shared_lock lock {m_mutex};
+
+        const auto iter = m_entries.find(key);
+        if (iter == m_entries.end() || iter->second.expires <= now)
+        {
+            return nullptr;
+        }
+
+        return iter->second.response;
+    }
+
+    // Keep `cached` under `key` for later requests to the same target, if there is room
+    void store(std::string_view key, const std::shared_ptr<const cached_response>& cached)
+    {
+        const auto size = cached->bytes.size();
+        if (not is_cacheable(cached->bytes) || size > m_options.max_bytes)
+        {
+            return;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        const std::unique_lock lock {m_mutex};
+
+        if (const auto iter = m_entries.find(key); iter != m_entries.end())
+        {
+            m_bytes -= iter->second.response->bytes.size();
+            m_entries.erase(iter);
+        }
+
+        if (m_entries.size() >= m_options.max_entries || m_bytes + size > m_options.max_bytes)
+        {
+            remove_expired(now);
+        }
+
+        if (m_entries.size() < m_options.max_entries && m_bytes + size <= m_options.max_bytes)
+        {
+            m_bytes += size;
+            m_entries.emplace(std::string(key), entry {cached, now + m_options.ttl});
+        }
+    }
+};
+}  // namespace detail
+}  // namespace mech_suit
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
@@ -11,7 +14,11 @@
 #include "mech_suit/boost.hpp"
 #include "mech_suit/common.hpp"
 #include "mech_suit/http_request.hpp"
+#include "mech_suit/media_type.hpp"
+#include "mech_suit/offload.hpp"
 #include "mech_suit/path_params.hpp"
+#include "mech_suit/response.hpp"
+#include "mech_suit/tracing.hpp"
 #include "mech_suit/error_handlers.hpp"
 
 namespace mech_suit::detail
@@ -32,6 +39,13 @@ struct route_callback<Method, std::tuple<Ts...>, no_body_t>
     using type = std::function<http::message_generator(const http_request&, typename Ts::type...)>;
 };
 
+// A streamed body isn't passed to the callback, which instead returns what to do with it
+template<http::verb Method, typename... Ts>
+struct route_callback<Method, std::tuple<Ts...>, body_stream>
+{
+    using type = std::function<stream_handler(const http_request&, typename Ts::type...)>;
+};
+
 template<meta::string Path, http::verb Method, typename Body>
 struct callback_type
 {
@@ -41,6 +55,62 @@ struct callback_type
 template<meta::string Path, http::verb Method, typename Body = no_body_t>
 using callback_type_t = callback_type<Path, Method, Body>::type;
 
+// What `Callback` returns when it is called like `Function`, or no `type` if it can't be
+template<typename Callback, typename Function>
+struct callback_result
+{
+};
+
+template<typename Callback, typename R, typename... Args>
+    requires(std::is_invocable_v<const Callback&, Args...>)
+struct callback_result<Callback, std::function<R(Args...)>> : std::invoke_result<const Callback&, Args...>
+{
+};
+
+// `Callback` can be called like `Function`, but returns something other than a response
+template<typename Callback, typename Function>
+concept returns_value = requires { typename callback_result<Callback, Function>::type; }
+    && not std::is_convertible_v<typename callback_result<Callback, Function>::type, http::message_generator>;
+
+template<typename Function, typename Result>
+struct with_result;
+
+template<typename R, typename... Args, typename Result>
+struct with_result<std::function<R(Args...)>, Result>
+{
+    using type = std::function<Result(Args...)>;
+};
+
+// The same arguments as a `route_callback`, for a callback that returns a value to serialize
+template<meta::string Path, http::verb Method, typename Body, typename Result>
+using typed_callback_type_t = typename with_result<callback_type_t<Path, Method, Body>, Result>::type;
+
+// The same arguments as a `route_callback`, for a coroutine that is awaited by the session
+template<http::verb Method, typename T, typename Body>
+struct async_route_callback;
+
+template<http::verb Method, typename... Ts, typename Body>
+struct async_route_callback<Method, std::tuple<Ts...>, Body>
+{
+    using type = std::function<net::awaitable<http::message_generator>(
+        const http_request&, typename Ts::type..., const typename Body::type&)>;
+};
+
+template<http::verb Method, typename... Ts>
+struct async_route_callback<Method, std::tuple<Ts...>, no_body_t>
+{
+    using type = std::function<net::awaitable<http::message_generator>(const http_request&, typename Ts::type...)>;
+};
+
+template<meta::string Path, http::verb Method, typename Body>
+struct async_callback_type
+{
+    using type = async_route_callback<Method, params_tuple_t<Path>, Body>::type;
+};
+
+template<meta::string Path, http::verb Method, typename Body = no_body_t>
+using async_callback_type_t = async_callback_type<Path, Method, Body>::type;
+
 class base_route
 {
   public:
@@ -52,49 +122,52 @@ class base_route
 
     virtual ~base_route() = default;
 
-    virtual auto test_match(const std::vector<std::string_view>& path) const -> bool = 0;
-    virtual auto handle_request(const http_request& request, exception_handler_t e_handler, glz_parse_error_handler_t glz_handler) const -> http::message_generator = 0;
+    // Its place among the routes of its router, e.g. to count its requests in `metrics`
+    size_t id = 0;
+
+    virtual auto handle_request(const http_request& request,
+                                std::span<const std::string_view> parts,
+                                const exception_handler_t& e_handler,
+                                const glz_parse_error_handler_t& glz_handler) const -> http::message_generator = 0;
+
+    // Whether the callback is a coroutine, that can only be called with `handle_request_async`
+    [[nodiscard]] virtual auto is_async() const -> bool = 0;
+
+    virtual auto handle_request_async(const http_request& request,
+                                      std::span<const std::string_view> parts,
+                                      const exception_handler_t& e_handler,
+                                      const glz_parse_error_handler_t& glz_handler) const
+        -> net::awaitable<http::message_generator> = 0;
+
+    // Nothing for a route that doesn't stream its body
+    virtual auto open_stream(const http_request& request, std::span<const std::string_view> parts) const
+        -> std::optional<stream_handler> = 0;
+
+    // Whether its body can be read from a request with `content_type`
+    [[nodiscard]] virtual auto accepts_content_type(std::string_view content_type) const -> bool = 0;
 };
 
+// Everything that is known about a route from its declaration: the parts of its path,
+// how to match them and how to invoke a callback with the parsed params and body.
+// It holds no state, so it is shared by `route` and the compile time `static_route`
 template<meta::string Path, http::verb Method, typename Body>
-class route : public base_route
+class route_impl
 {
   public:
-    using callback_t = callback_type_t<Path, Method, Body>;
     using params_t = http_params<Path>;
 
     static constexpr bool route_is_explicit = std::tuple_size_v<typename params_t::tuple_t> == 0;
 
-    explicit route(callback_t callback)
-        : m_callback(callback)
-    {
-    }
+    static constexpr bool streams_body = std::is_same_v<body_stream, Body>;
 
-    auto test_match(const std::vector<std::string_view>& parts) const -> bool final
-    {
-        // This should not be called for explicit routes,
-        // since we can do a simple string comparison
-        if constexpr (route_is_explicit)
-        {
-            assert(not route_is_explicit);
-            return false;
-        }
+    template<typename Callback>
+    static constexpr bool is_async_callback =
+        std::is_convertible_v<Callback, async_callback_type_t<Path, Method, Body>>;
 
-        if (parts.size() != std::tuple_size_v<param_parts_tuple_t>)
-        {
-            return false;
-        }
-
-        for (size_t i = 0; i < parts.size(); i++)
-        {
-            if (not test_part_match(i, parts[i]))
-            {
-                return false;
-            }
-        }
-
-        return true;
-    }
+    // The callback returns a value to serialize with glaze, rather than a response
+    template<typename Callback>
+    static constexpr bool is_typed_callback = not streams_body && not is_async_callback<Callback>
+        && returns_value<Callback, callback_type_t<Path, Method, Body>>;
 
   private:
     using body_t = typename Body::type;
@@ -112,6 +185,8 @@ class route : public base_route
         return n;
     }
 
+    static_assert(path_part_count() <= max_path_parts, "Route path has too many parts");
+
     // the regular case when no placeholder is at the part
     template<size_t Idx>
     struct part_at
@@ -138,7 +213,7 @@ class route : public base_route
                 begin = end + 1;
             }
 
-            return {std::distance(path.begin(), begin), std::distance(path.begin(), end) - 1};
+            return {std::distance(path.begin(), begin), std::distance(begin, end)};
         }
 
         static constexpr auto pair = impl();
@@ -164,86 +239,220 @@ class route : public base_route
     };
 
     using path_parts_seq_t = decltype(std::make_index_sequence<path_part_count()>());
-    using param_parts_tuple_t = typename make_parts<path_parts_seq_t>::type;
 
-  protected:
+    // one flat expression, with every part's matcher known at compile time
+    template<typename... Ts>
+    static auto test_parts(std::type_identity<std::tuple<Ts...>> /*unused*/, std::span<const std::string_view> parts)
+        -> bool
+    {
+        return (... && Ts::matches(parts[Ts::part_n]));
+    }
+
+    template<typename... Ts>
+    static constexpr auto init_segments(std::type_identity<std::tuple<Ts...>> /*unused*/)
+        -> std::array<path_segment, sizeof...(Ts)>
+    {
+        return {Ts::segment...};
+    }
+
+    // Fill `body` from the body of the request, before the callback is called with it.
+    // glaze parses the bytes where they were read, so `std::string_view` members of `body`
+    // point into the request and are valid for as long as it is
+    static auto read_body(const http_request& request, body_t& body) -> glz::parse_error
+    {
+        const auto& request_body = request.beast_request.body();
+        const std::string_view bytes {request_body.data(), request_body.size()};
+
+        if constexpr (body_is_glz_v<Body>)
+        {
+            return glz::read<Body::opts>(body, bytes);
+        }
+        else if constexpr (body_is_glz_any_v<Body>)
+        {
+            if (is_beve(request.beast_request[http::field::content_type]))
+            {
+                return glz::read<glz::opts {.format = glz::binary}>(body, bytes);
+            }
+
+            return glz::read<glz::opts {.format = glz::json}>(body, bytes);
+        }
+        else if constexpr (std::is_same_v<body_string, Body>)
+        {
+            body.assign(bytes);
+        }
+
+        return {};
+    }
+
     // The case for a route with no params but a body
-    template<typename T = void>
+    template<typename Callback>
         requires(not std::is_same_v<std::false_type, body_t> && params_t::size == 0)
-    auto call_callback(const http_request& request, const body_t& body) const
+    static auto call_callback(const Callback& callback, const http_request& request, const body_t& body)
     {
-        params_t pararms {request.path};
-        return m_callback(request, body);
+        return callback(request, body);
     }
 
     // The case for a route with params and body
-    template<size_t... Is>
+    template<typename Callback, size_t... Is>
         requires(not std::is_same_v<std::false_type, body_t>)
-    auto call_callback(std::index_sequence<Is...> /*unused*/, const http_request& request, const body_t& body) const
+    static auto call_callback(std::index_sequence<Is...> /*unused*/,
+                              const Callback& callback,
+                              const http_request& request,
+                              std::span<const std::string_view> parts,
+                              const body_t& body)
     {
-        params_t params {request.path};
-        return m_callback(
-            request, std::get<typename params_t::template param_type_at_index<Is>::type>(params.params[Is])..., body);
+        params_t params {parts};
+        return callback(request, std::get<Is>(params.params)..., body);
     }
 
     // The case for a route with no params and no body
-    auto call_callback(const http_request& request) const
+    template<typename Callback>
+    static auto call_callback(const Callback& callback, const http_request& request)
     {
-        params_t pararms {request.path};
-        return m_callback(request);
+        return callback(request);
     }
 
     // The case for a route with params but no body
-    template<size_t... Is>
-    auto call_callback(std::index_sequence<Is...> /*unused*/, const http_request& request) const
+    template<typename Callback, size_t... Is>
+    static auto call_callback(std::index_sequence<Is...> /*unused*/,
+                              const Callback& callback,
+                              const http_request& request,
+                              std::span<const std::string_view> parts)
     {
-        params_t params {request.path};
-        return m_callback(request,
-                          std::get<typename params_t::template param_type_at_index<Is>::type>(params.params[Is])...);
+        params_t params {parts};
+        return callback(request, std::get<Is>(params.params)...);
     }
 
-    auto handle_request(const http_request& request, exception_handler_t e_handler, glz_parse_error_handler_t glz_handler) const -> http::message_generator final
+  public:
+    using param_parts_tuple_t = typename make_parts<path_parts_seq_t>::type;
+
+    static constexpr size_t part_count = std::tuple_size_v<param_parts_tuple_t>;
+
+    // The parts of `Path`, used to place this route in the router's trie
+    static constexpr auto path_segments = init_segments(std::type_identity<param_parts_tuple_t> {});
+
+    static auto test_match(std::span<const std::string_view> parts) -> bool
     {
-        using iseq_t = decltype(std::make_index_sequence<params_t::size>());
+        return parts.size() == part_count && test_parts(std::type_identity<param_parts_tuple_t> {}, parts);
+    }
 
-        if constexpr (std::is_same_v<std::false_type, body_t>)
+    // Whether a body sent as `content_type` is in a format the route reads. A body
+    // without a Content-Type is taken to be in that format, and one read as a
+    // string or streamed can be anything
+    static auto accepts_content_type(std::string_view content_type) -> bool
+    {
+        if (content_type.empty())
+        {
+            return true;
+        }
+
+        if constexpr (body_is_glz_v<Body>)
         {
-            if constexpr (params_t::size)
+            if constexpr (Body::opts.format == glz::binary)
             {
-                return call_callback(iseq_t(), request);
+                return is_beve(content_type) || beast::iequals(media_type(content_type), "application/octet-stream");
+            }
+            else if constexpr (Body::opts.format == glz::json)
+            {
+                return is_json(content_type);
             }
             else
             {
-                return call_callback(request);
+                return true;
             }
         }
+        else if constexpr (body_is_glz_any_v<Body>)
+        {
+            return is_json(content_type) || is_beve(content_type);
+        }
         else
         {
-            // TODO: investigate using custom body
-            // TODO: investigate lazy streaming of body
+            return true;
+        }
+    }
 
-            body_t body;
-            if constexpr (body_is_glz_v<Body>)
+    // Call the callback of a `body_stream` route, before any of the body has been read
+    template<typename Callback>
+        requires(streams_body)
+    static auto open_stream(const Callback& callback,
+                            const http_request& request,
+                            std::span<const std::string_view> parts) -> stream_handler
+    {
+        if constexpr (params_t::size)
+        {
+            return call_callback(std::make_index_sequence<params_t::size>(), callback, request, parts);
+        }
+        else
+        {
+            return call_callback(callback, request);
+        }
+    }
+
+    template<typename Callback>
+    static auto handle_request(const Callback& callback,
+                               const http_request& request,
+                               std::span<const std::string_view> parts,
+                               const exception_handler_t& e_handler,
+                               const glz_parse_error_handler_t& glz_handler) -> http::message_generator
+    {
+        using iseq_t = decltype(std::make_index_sequence<params_t::size>());
+
+        if constexpr (std::is_same_v<std::false_type, body_t>)
+        {
+            try
             {
-                auto err = glz::read<Body::opts>(body, request.beast_request.body());
-                if (err)
+                if constexpr (params_t::size)
                 {
-                    return glz_handler(request, err);
+                    return to_response(request, call_callback(iseq_t(), callback, request, parts));
+                }
+                else
+                {
+                    return to_response(request, call_callback(callback, request));
                 }
             }
-            else if constexpr (std::is_same_v<body_string, Body>)
+            catch (std::exception const& except)
             {
-                body = request.beast_request.body();
+                return e_handler(request, except);
+            }
+        }
+        else if constexpr (streams_body)
+        {
+            // the whole body has already been read, so it is streamed as one chunk
+            try
+            {
+                auto stream = open_stream(callback, request, parts);
+
+                const auto& body = request.beast_request.body();
+                if (not body.empty())
+                {
+                    stream.on_chunk({body.data(), body.size()});
+                }
+
+                return stream.on_end();
+            }
+            catch (std::exception const& except)
+            {
+                return e_handler(request, except);
+            }
+        }
+        else
+        {
+            body_t body;
+            const auto err = read_body(request, body);
+            mark_stage(request.trace, request_trace::body_parsed);
+            if (err)
+            {
+                return glz_handler(request, err);
             }
 
             try {
                 if constexpr (params_t::size)
                 {
-                    return call_callback(iseq_t(), request, body);
+                    return to_response(request, call_callback(iseq_t(), callback, request, parts, body));
                 }
                 else
                 {
-                    return call_callback(request, body);
+                    return to_response(request, call_callback(callback, request, body));
                 }
             }
             catch (std::exception const& except)
@@ -253,26 +462,200 @@ class route : public base_route
         }
     }
 
-  private:
-    auto test_part_match(size_t idx, std::string_view part) const -> bool
+    // The callback is awaited if it is a coroutine, otherwise this is the same as `handle_request`.
+    // Everything passed by reference has to outlive the returned awaitable
+    template<typename Callback>
+    static auto handle_request_async(const Callback& callback,
+                                     const http_request& request,
+                                     std::span<const std::string_view> parts,
+                                     const exception_handler_t& e_handler,
+                                     const glz_parse_error_handler_t& glz_handler)
+        -> net::awaitable<http::message_generator>
     {
-        if (idx >= std::tuple_size_v<param_parts_tuple_t>)
+        using iseq_t = decltype(std::make_index_sequence<params_t::size>());
+
+        if constexpr (not is_async_callback<Callback>)
         {
-            return false;
+            co_return handle_request(callback, request, parts, e_handler, glz_handler);
+        }
+        else if constexpr (std::is_same_v<std::false_type, body_t>)
+        {
+            try
+            {
+                if constexpr (params_t::size)
+                {
+                    co_return co_await call_callback(iseq_t(), callback, request, parts);
+                }
+                else
+                {
+                    co_return co_await call_callback(callback, request);
+                }
+            }
+            catch (std::exception const& except)
+            {
+                co_return e_handler(request, except);
+            }
         }
+        else
+        {
+            // kept in the coroutine frame while the callback is suspended
+            body_t body;
+            const auto err = read_body(request, body);
+            mark_stage(request.trace, request_trace::body_parsed);
+            if (err)
+            {
+                co_return glz_handler(request, err);
+            }
 
-        return m_param_parts[idx]->test_path_part(part);
+            try
+            {
+                if constexpr (params_t::size)
+                {
+                    co_return co_await call_callback(iseq_t(), callback, request, parts, body);
+                }
+                else
+                {
+                    co_return co_await call_callback(callback, request, body);
+                }
+            }
+            catch (std::exception const& except)
+            {
+                co_return e_handler(request, except);
+            }
+        }
     }
+};
 
-    template<typename... Ts>
-    static constexpr auto init_parts(std::tuple<Ts...> /*unused*/)
-        -> std::array<std::unique_ptr<base_path_part>, sizeof...(Ts)>
+// A route registered at runtime, with its callback type erased.
+// `Callback` is a `callback_type_t`, `typed_callback_type_t` or `async_callback_type_t`
+template<meta::string Path, http::verb Method, typename Body, typename Callback = callback_type_t<Path, Method, Body>>
+class route : public base_route
+{
+    using impl_t = route_impl<Path, Method, Body>;
+
+  public:
+    using callback_t = Callback;
+    using params_t = typename impl_t::params_t;
+
+    static constexpr bool route_is_explicit = impl_t::route_is_explicit;
+    static constexpr auto path_segments = impl_t::path_segments;
+
+    explicit route(callback_t callback)
+        : m_callback(std::move(callback))
+    {
+    }
+
+    static auto test_match(std::span<const std::string_view> parts) -> bool
+    {
+        return impl_t::test_match(parts);
+    }
+
+    auto handle_request(const http_request& request,
+                        std::span<const std::string_view> parts,
+                        const exception_handler_t& e_handler,
+                        const glz_parse_error_handler_t& glz_handler) const -> http::message_generator final
+    {
+        if constexpr (impl_t::template is_async_callback<callback_t>)
+        {
+            throw std::logic_error("A coroutine route has to be called with handle_request_async");
+        }
+        else
+        {
+            return impl_t::handle_request(m_callback, request, parts, e_handler, glz_handler);
+        }
+    }
+
+    [[nodiscard]] auto is_async() const -> bool final { return impl_t::template is_async_callback<callback_t>; }
+
+    auto handle_request_async(const http_request& request,
+                              std::span<const std::string_view> parts,
+                              const exception_handler_t& e_handler,
+                              const glz_parse_error_handler_t& glz_handler) const
+        -> net::awaitable<http::message_generator> final
+    {
+        return impl_t::handle_request_async(m_callback, request, parts, e_handler, glz_handler);
+    }
+
+    auto open_stream(const http_request& request, std::span<const std::string_view> parts) const
+        -> std::optional<stream_handler> final
+    {
+        if constexpr (impl_t::streams_body)
+        {
+            return impl_t::open_stream(m_callback, request, parts);
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    [[nodiscard]] auto accepts_content_type(std::string_view content_type) const -> bool final
     {
-        return {std::make_unique<Ts>()...};
+        return impl_t::accepts_content_type(content_type);
     }
 
+  private:
+    callback_t m_callback;
+};
+
+// A route registered at runtime whose callback is run on a worker pool.
+// The session awaits it like a coroutine route, so the connection's thread carries on meanwhile
+template<meta::string Path, http::verb Method, typename Body>
+class offloaded_route : public base_route
+{
+    using impl_t = route_impl<Path, Method, Body>;
+
+    static_assert(not impl_t::streams_body, "A streamed body is handed to its route as it is read");
+
+  public:
+    using callback_t = callback_type_t<Path, Method, Body>;
+    using params_t = typename impl_t::params_t;
+
+    static constexpr bool route_is_explicit = impl_t::route_is_explicit;
+    static constexpr auto path_segments = impl_t::path_segments;
+
+    offloaded_route(callback_t callback, net::thread_pool& pool)
+        : m_callback(std::move(callback))
+        , m_pool(pool)
+    {
+    }
+
+    // Runs the callback right away, on the calling thread
+    auto handle_request(const http_request& request,
+                        std::span<const std::string_view> parts,
+                        const exception_handler_t& e_handler,
+                        const glz_parse_error_handler_t& glz_handler) const -> http::message_generator final
+    {
+        return impl_t::handle_request(m_callback, request, parts, e_handler, glz_handler);
+    }
+
+    [[nodiscard]] auto is_async() const -> bool final { return true; }
+
+    // The body is parsed on the pool as well
+    auto handle_request_async(const http_request& request,
+                              std::span<const std::string_view> parts,
+                              const exception_handler_t& e_handler,
+                              const glz_parse_error_handler_t& glz_handler) const
+        -> net::awaitable<http::message_generator> final
+    {
+        return run_on(m_pool,
+                      [this, &request, parts, &e_handler, &glz_handler]
+                      { return impl_t::handle_request(m_callback, request, parts, e_handler, glz_handler); });
+    }
+
+    auto open_stream(const http_request& /*request*/, std::span<const std::string_view> /*parts*/) const
+        -> std::optional<stream_handler> final
+    {
+        return std::nullopt;
+    }
+
+    [[nodiscard]] auto accepts_content_type(std::string_view content_type) const -> bool final
+    {
+        return impl_t::accepts_content_type(content_type);
+    }
+
+  private:
     callback_t m_callback;
-    std::array<std::unique_ptr<base_path_part>, std::tuple_size_v<param_parts_tuple_t>> m_param_parts =
-        init_parts(param_parts_tuple_t {});
+    net::thread_pool& m_pool;
 };
 }  // namespace mech_suit::detail
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit::detail
+{
+// How a route is labelled in metrics and traces
+struct route_label
+{
+    http::verb method;
+    std::string path;
+};
+}  // namespace mech_suit::detail
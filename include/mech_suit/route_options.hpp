@@ -0,0 +1,17 @@
+#pragma once
+#include <optional>
+
+#include "mech_suit/compression.hpp"
+#include "mech_suit/response_cache.hpp"
+
+namespace mech_suit
+{
+// What is done with the responses of a route after its callback returns them
+struct route_options
+{
+    // Only for GET routes
+    std::optional<cache_options> cache {};
+
+    std::optional<compression_options> compression {};
+};
+}  // namespace mech_suit
@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "mech_suit/path_params.hpp"
+
+namespace mech_suit::detail
+{
+// Split the next part off the front of a path, with its leading `/` already removed
+inline auto next_path_part(std::string_view& path) -> std::string_view
+{
+    auto part = path.substr(0, path.find('/'));
+
+    // skip the next slash (if there is one)
+    path.remove_prefix(std::min(path.size(), part.size() + 1));
+
+    return part;
+}
+
+// Prefix tree of routes keyed on the parts of their paths.
+// A lookup walks the request path once, so the cost depends on how deep the
+// path is rather than how many routes are registered.
+// Literal parts are preferred over placeholders, and placeholders that accept
+// anything (`:string`) are only tried once every other candidate has failed
+template<typename Route>
+class route_trie
+{
+    struct node
+    {
+        std::unordered_map<std::string_view, std::unique_ptr<node>> literals;
+        std::vector<std::pair<path_segment, std::unique_ptr<node>>> placeholders;
+        std::unique_ptr<Route> route;
+    };
+
+    node m_root;
+
+    static auto find_impl(const node& current, std::string_view path, std::span<std::string_view> parts, size_t depth)
+        -> const Route*
+    {
+        if (path.empty())
+        {
+            return current.route.get();
+        }
+
+        // deeper than any route can be
+        if (depth >= parts.size())
+        {
+            return nullptr;
+        }
+
+        const auto part = next_path_part(path);
+        parts[depth] = part;
+
+        if (const auto iter = current.literals.find(part); iter != current.literals.end())
+        {
+            if (const auto* route = find_impl(*iter->second, path, parts, depth + 1))
+            {
+                return route;
+            }
+        }
+
+        for (const auto& [segment, child] : current.placeholders)
+        {
+            if (segment.matcher(part))
+            {
+                if (const auto* route = find_impl(*child, path, parts, depth + 1))
+                {
+                    return route;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+  public:
+    // Returns false if a route with an equivalent path is already registered
+    auto insert(std::span<const path_segment> segments, std::unique_ptr<Route> route) -> bool
+    {
+        node* current = &m_root;
+
+        for (const auto& segment : segments)
+        {
+            if (segment.is_placeholder())
+            {
+                auto& placeholders = current->placeholders;
+                auto iter = std::find_if(placeholders.begin(),
+                                         placeholders.end(),
+                                         [&](const auto& entry) { return entry.first.matcher == segment.matcher; });
+
+                if (iter == placeholders.end())
+                {
+                    // keep the catch-all placeholders behind the more specific ones
+                    auto pos = segment.catch_all
+                        ? placeholders.end()
+                        : std::find_if(placeholders.begin(),
+                                       placeholders.end(),
+                                       [](const auto& entry) { return entry.first.catch_all; });
+
+                    iter = placeholders.emplace(pos, segment, std::make_unique<node>());
+                }
+
+                current = iter->second.get();
+            }
+            else
+            {
+                auto& child = current->literals[segment.literal];
+                if (!child)
+                {
+                    child = std::make_unique<node>();
+                }
+
+                current = child.get();
+            }
+        }
+
+        if (current->route)
+        {
+            return false;
+        }
+
+        current->route = std::move(route);
+        return true;
+    }
+
+    // Split `path` into `parts` while searching, so that the matched route
+    // can read its parameters without splitting the path again
+    auto find(std::string_view path, std::span<std::string_view> parts) const -> const Route*
+    {
+        // skip the leading slash
+        return find_impl(m_root, path.substr(std::min<size_t>(1, path.size())), parts, 0);
+    }
+};
+}  // namespace mech_suit::detail
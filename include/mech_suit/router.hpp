@@ -1,146 +1,390 @@
 #pragma once
 
+#include <algorithm>
+#include <deque>
 #include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/beast/http/message_generator.hpp>
 #include <glaze/core/context.hpp>
 
 #include "mech_suit/boost.hpp"
 #include "mech_suit/error_handlers.hpp"
+#include "mech_suit/metrics.hpp"
+#include "mech_suit/response_cache.hpp"
+#include "mech_suit/route_options.hpp"
 #include "mech_suit/route.hpp"
+#include "mech_suit/route_trie.hpp"
+#include "mech_suit/static_files.hpp"
 
 namespace mech_suit::detail
 {
 class router
+    : public router_error_handlers
+    , public static_file_server
+    , public metrics_server
 {
     std::unordered_map<http::verb,
                        std::unordered_map<std::string_view, std::unique_ptr<detail::base_route>>>
         m_routes;
 
-    std::unordered_multimap<http::verb, std::unique_ptr<detail::base_route>> m_dynamic_routes;
+    std::unordered_map<http::verb, route_trie<detail::base_route>> m_dynamic_routes;
 
-    static auto not_found(const http_request& request) -> http::message_generator
+    // What is done with the responses of a route after its callback, for the cached routes.
+    // Compression is instead part of the callback, before its response is serialized
+    struct route_extras
     {
-        http::response<http::string_body> res {http::status::not_found,
-                                               request.beast_request.version()};
+        std::unique_ptr<response_cache> cache;
+    };
 
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(false);
-        res.body() = "Not found\n";
-        res.prepare_payload();
+    std::unordered_map<const base_route*, route_extras> m_extras;
 
-        return res;
+    // By route id
+    std::vector<route_label> m_route_labels;
+
+    // The paths of the routes added with `add_route_at`, which the tables keep views of
+    std::deque<std::string> m_paths;
+
+    void label(base_route& route, http::verb method, std::string_view path)
+    {
+        route.id = m_route_labels.size();
+        m_route_labels.push_back({method, std::string(path)});
     }
 
-    static auto unprocessable(const http_request& request, glz::parse_error error)
-        -> http::message_generator
+    static void throw_duplicate(http::verb method, std::string_view path)
     {
+        throw std::invalid_argument("A route is already registered for " + std::string(http::to_string(method)) + ' '
+                                    + std::string(path));
+    }
 
-        std::string message = glz::format_error(error, request.beast_request.body());
+    // Throws rather than dropping a route with the same method and an equivalent path as another
+    template<meta::string Path, http::verb Method, typename Route>
+    auto insert(std::unique_ptr<Route> route) -> base_route&
+    {
+        auto& inserted = *route;
 
-        http::response<http::string_body> res {http::status::unprocessable_entity,
-                                               request.beast_request.version()};
+        bool added = false;
+        if constexpr (Route::route_is_explicit)
+        {
+            added = m_routes[Method].try_emplace(static_cast<const char*>(Path), std::move(route)).second;
+        }
+        else
+        {
+            added = m_dynamic_routes[Method].insert(Route::path_segments, std::move(route));
+        }
 
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(false);
-        res.body() = std::move(message);
-        res.prepare_payload();
+        if (not added)
+        {
+            throw_duplicate(Method, static_cast<std::string_view>(Path));
+        }
 
-        return res;
+        label(inserted, Method, static_cast<std::string_view>(Path));
+        return inserted;
     }
 
-    static auto exception(const http_request& request, std::exception const& except)
-        -> http::message_generator
+    auto find_extras(const base_route* route) const -> const route_extras*
     {
-        http::response<http::string_body> res {http::status::internal_server_error,
-                                               request.beast_request.version()};
-
-        res.set(http::field::content_type, "text/html");
-        res.keep_alive(false);
-        res.body() = except.what();
-        res.prepare_payload();
+        if (m_extras.empty())
+        {
+            return nullptr;
+        }
 
-        return res;
+        const auto iter = m_extras.find(route);
+        return iter == m_extras.end() ? nullptr : &iter->second;
     }
 
-    glz_parse_error_handler_t m_glz_parse_error_handler = router::unprocessable;
-    exception_handler_t m_exception_handler = router::exception;
-    not_found_handler_t m_not_found_handler = router::not_found;
-
   public:
     template<meta::string Path, http::verb Method, typename Body = no_body_t>
     void add_route(detail::callback_type_t<Path, Method, Body> callback)
+    {
+        insert<Path, Method>(std::make_unique<detail::route<Path, Method, Body>>(callback));
+    }
+
+    // The callback is run on `pool`, which has to outlive the router
+    template<meta::string Path, http::verb Method, typename Body = no_body_t>
+    void add_route(detail::callback_type_t<Path, Method, Body> callback, net::thread_pool& pool)
+    {
+        insert<Path, Method>(std::make_unique<detail::offloaded_route<Path, Method, Body>>(callback, pool));
+    }
+
+    // The callback returns a value, `glz_response` or `glz_any_response`, which is serialized into the response
+    template<meta::string Path, http::verb Method, typename Body = no_body_t, typename Callback>
+        requires(detail::route_impl<Path, Method, Body>::template is_typed_callback<Callback>)
+    void add_route(Callback callback)
+    {
+        using result_t = typename callback_result<Callback, callback_type_t<Path, Method, Body>>::type;
+        using callback_t = typed_callback_type_t<Path, Method, Body, result_t>;
+        insert<Path, Method>(std::make_unique<detail::route<Path, Method, Body, callback_t>>(std::move(callback)));
+    }
+
+    // Responses are cached or compressed, as set in `options`. A compressed route returns a response
+    // or a value rather than a `message_generator`, so that its body is compressed before it is serialized
+    template<meta::string Path, http::verb Method, typename Body = no_body_t, typename Callback>
+        requires(std::is_convertible_v<Callback, detail::callback_type_t<Path, Method, Body>>
+                 || detail::route_impl<Path, Method, Body>::template is_typed_callback<Callback>)
+    void add_route(Callback callback, route_options options)
+    {
+        using function_t = detail::callback_type_t<Path, Method, Body>;
+
+        if (options.cache && Method != http::verb::get)
+        {
+            throw std::invalid_argument("Only GET routes can be cached");
+        }
+
+        if (options.compression && (options.compression->level < 1 || options.compression->level > 9))
+        {
+            throw std::invalid_argument("Compression levels go from 1 to 9");
+        }
+
+        function_t function;
+        if constexpr (std::is_convertible_v<Callback, function_t>
+                      && (detail::route_impl<Path, Method, Body>::streams_body
+                          || std::is_same_v<std::remove_cvref_t<typename callback_result<Callback, function_t>::type>,
+                                            http::message_generator>))
+        {
+            if (options.compression)
+            {
+                throw std::invalid_argument("A compressed route has to return a response or a value, "
+                                            "not a message_generator");
+            }
+
+            function = std::move(callback);
+        }
+        else
+        {
+            function = compressed_callback<function_t>::make(std::move(callback), options.compression);
+        }
+
+        auto& route = insert<Path, Method>(std::make_unique<detail::route<Path, Method, Body>>(std::move(function)));
+        if (options.cache)
+        {
+            auto cache = std::make_unique<response_cache>(*options.cache, options.compression.has_value());
+            m_extras.emplace(&route, route_extras {std::move(cache)});
+        }
+    }
+
+    // Responses are kept for `options.ttl` and written again without calling the callback
+    template<meta::string Path, http::verb Method, typename Body = no_body_t>
+    void add_route(detail::callback_type_t<Path, Method, Body> callback, cache_options options)
+    {
+        static_assert(Method == http::verb::get, "Only GET routes can be cached");
+        add_route<Path, Method, Body>(std::move(callback),
+                                      route_options {.cache = options, .compression = std::nullopt});
+    }
+
+    template<meta::string Path, http::verb Method, typename Body = no_body_t>
+    void add_route(detail::async_callback_type_t<Path, Method, Body> callback)
+    {
+        using callback_t = detail::async_callback_type_t<Path, Method, Body>;
+        insert<Path, Method>(std::make_unique<detail::route<Path, Method, Body, callback_t>>(callback));
+    }
+
+    // Register a route under `path` rather than the path it is declared with.
+    // `path` must have the same shape as `Path`, with the same number of parts and
+    // placeholders in the same places. It is copied, so it needn't outlive the call.
+    // This lets large synthetic route tables be built without a template per route
+    template<meta::string Path, http::verb Method, typename Body = no_body_t>
+    void add_route_at(std::string_view path, detail::callback_type_t<Path, Method, Body> callback)
     {
         using route_t = detail::route<Path, Method, Body>;
+        const std::string_view owned = m_paths.emplace_back(path);
+
         auto route = std::make_unique<route_t>(callback);
+        auto& inserted = *route;
 
+        bool added = false;
         if constexpr (route_t::route_is_explicit)
         {
-            m_routes[Method].emplace(static_cast<const char*>(Path), std::move(route));
+            added = m_routes[Method].try_emplace(owned, std::move(route)).second;
         }
         else
         {
-            m_dynamic_routes.emplace(Method, std::move(route));
+            auto segments = route_t::path_segments;
+
+            auto rest = owned.substr(std::min<size_t>(1, owned.size()));
+            for (auto& segment : segments)
+            {
+                if (rest.empty())
+                {
+                    m_paths.pop_back();
+                    throw std::invalid_argument("Path has fewer parts than the route it is registered as");
+                }
+
+                const auto part = next_path_part(rest);
+                if (not segment.is_placeholder())
+                {
+                    segment.literal = part;
+                }
+            }
+
+            if (not rest.empty())
+            {
+                m_paths.pop_back();
+                throw std::invalid_argument("Path has more parts than the route it is registered as");
+            }
+
+            added = m_dynamic_routes[Method].insert(segments, std::move(route));
+        }
+
+        if (not added)
+        {
+            m_paths.pop_back();
+            throw_duplicate(Method, path);
         }
+
+        label(inserted, Method, owned);
     }
 
-    void add_not_found_handler(not_found_handler_t handler)
+    // The route a request is for, found from its headers alone
+    struct route_match
     {
-        m_not_found_handler = std::move(handler);
+        const base_route* route = nullptr;
+        path_parts_t parts {};
+
+        [[nodiscard]] auto found() const -> bool { return route != nullptr; }
+    };
+
+    auto find_route(const http_request& request) const -> route_match
+    {
+        const auto method = request.beast_request.method();
+        route_match match;
+
+        if (const auto routes = m_routes.find(method); routes != m_routes.end())
+        {
+            if (const auto iter = routes->second.find(request.path); iter != routes->second.end())
+            {
+                match.route = iter->second.get();
+                return match;
+            }
+        }
+
+        if (const auto iter = m_dynamic_routes.find(method); iter != m_dynamic_routes.end())
+        {
+            match.route = iter->second.find(request.path, match.parts);
+        }
+
+        return match;
     }
 
-    void add_exception_handler(exception_handler_t handler)
+    // Call the matched route now that the whole request has been read,
+    // unless it is cached and has already responded to the same target
+    auto handle_request(const http_request& request, const route_match& match) const -> response_t
     {
-        m_exception_handler = std::move(handler);
+        if (match.route == nullptr)
+        {
+            return handle_unmatched(request, allowed_methods(request));
+        }
+
+        const auto* extras = find_extras(match.route);
+        if (extras == nullptr)
+        {
+            return match.route->handle_request(request, match.parts, m_exception_handler, m_glz_parse_error_handler);
+        }
+
+        // built once per request, into a buffer that the thread keeps, so that a hit doesn't allocate
+        static thread_local std::string key;
+        extras->cache->make_key(request, key);
+        if (auto cached = extras->cache->find(key))
+        {
+            return cached;
+        }
+
+        auto response =
+            match.route->handle_request(request, match.parts, m_exception_handler, m_glz_parse_error_handler);
+        const bool keep_alive = response.keep_alive();
+
+        auto serialized = std::make_shared<const cached_response>(cached_response {serialize(response), keep_alive});
+        extras->cache->store(key, serialized);
+        return serialized;
     }
 
-    void add_glz_parse_error_handler(glz_parse_error_handler_t handler)
+    auto handle_request(const http_request& request) const -> response_t
     {
-        m_glz_parse_error_handler = std::move(handler);
+        return handle_request(request, find_route(request));
     }
 
-    auto handle_request(http_request request) const -> http::message_generator
+    // Every route, in the order of their ids
+    [[nodiscard]] auto route_labels() const -> std::span<const route_label> { return m_route_labels; }
+
+    // `match` has to be for one of the routes
+    [[nodiscard]] static auto route_id(const route_match& match) -> size_t { return match.route->id; }
+
+    auto find_metrics(const http_request& request) const -> std::optional<http::message_generator>
     {
-        const auto method = request.beast_request.method();
+        return metrics_response(request, route_labels());
+    }
 
-        if (m_routes.contains(method) && m_routes.at(method).contains(request.path))
-        {
-            const auto& route = m_routes.at(method).at(request.path);
+    auto find_traces(const http_request& request) const -> std::optional<http::message_generator>
+    {
+        return traces_response(request, route_labels());
+    }
 
-            return route->handle_request(request, m_exception_handler, m_glz_parse_error_handler);
+    // A matched route with a coroutine callback is called with `handle_request_async`
+    [[nodiscard]] auto is_async(const route_match& match) const -> bool
+    {
+        return match.route != nullptr && match.route->is_async();
+    }
+
+    // `request` and `match` have to outlive the returned awaitable
+    auto handle_request_async(const http_request& request, const route_match& match) const
+        -> net::awaitable<http::message_generator>
+    {
+        if (match.route == nullptr)
+        {
+            co_return handle_unmatched(request, allowed_methods(request));
         }
 
-        std::vector<std::string_view> parts;
-        // skip the leading slash
-        std::string_view path = request.path.substr(1);
-        while (!path.empty())
+        co_return co_await match.route->handle_request_async(
+            request, match.parts, m_exception_handler, m_glz_parse_error_handler);
+    }
+
+    // Nothing if the matched route reads the whole body before it is called
+    auto open_stream(const http_request& request, const route_match& match) const -> std::optional<stream_handler>
+    {
+        if (match.route == nullptr)
         {
-            auto part = path.substr(0, path.find('/'));
-            parts.push_back(part);
+            return std::nullopt;
+        }
 
-            // skip the next slash (if there is one)
-            if (path.size() > part.size() + 1)
-            {
-                path = path.substr(part.size() + 1);
-            }
-            else
+        return match.route->open_stream(request, match.parts);
+    }
+
+    // Whether the matched route can read a body in the Content-Type of `request`
+    auto accepts_content_type(const http_request& request, const route_match& match) const -> bool
+    {
+        return match.route == nullptr
+            || match.route->accepts_content_type(request.beast_request[http::field::content_type]);
+    }
+
+    // Every method with a route for the path of `request`
+    auto allowed_methods(const http_request& request) const -> std::vector<http::verb>
+    {
+        std::vector<http::verb> allowed;
+
+        for (const auto& [method, routes] : m_routes)
+        {
+            if (routes.contains(request.path))
             {
-                path = path.substr(part.size());
+                allowed.push_back(method);
             }
         }
 
-        auto range = m_dynamic_routes.equal_range(method);
-        for (auto it = range.first; it != range.second; it++)
+        path_parts_t parts;
+        for (const auto& [method, routes] : m_dynamic_routes)
         {
-            if (it->second->test_match(parts))
+            if (std::find(allowed.begin(), allowed.end(), method) == allowed.end()
+                && routes.find(request.path, parts) != nullptr)
             {
-                return it->second->handle_request(
-                    request, m_exception_handler, m_glz_parse_error_handler);
+                allowed.push_back(method);
             }
         }
 
-        return m_not_found_handler(request);
+        return allowed;
     }
 };
 }  // namespace mech_suit::detail
@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mech_suit/boost.hpp"
+#include "mech_suit/http_request.hpp"
+
+namespace mech_suit::detail
+{
+// Content type for the extension of `path`
+inline auto mime_type(std::string_view path) -> std::string_view
+{
+    static constexpr std::array<std::pair<std::string_view, std::string_view>, 26> types {{
+        {".htm", "text/html"},
+        {".html", "text/html"},
+        {".css", "text/css"},
+        {".txt", "text/plain"},
+        {".csv", "text/csv"},
+        {".js", "application/javascript"},
+        {".mjs", "application/javascript"},
+        {".json", "application/json"},
+        {".xml", "application/xml"},
+        {".pdf", "application/pdf"},
+        {".wasm", "application/wasm"},
+        {".zip", "application/zip"},
+        {".gz", "application/gzip"},
+        {".png", "image/png"},
+        {".jpe", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".jpg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/vnd.microsoft.icon"},
+        {".svg", "image/svg+xml"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".mp4", "video/mp4"},
+        {".webm", "video/webm"},
+        {".mp3", "audio/mpeg"},
+    }};
+
+    const auto dot = path.rfind('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos)
+    {
+        return "application/octet-stream";
+    }
+
+    const auto ext = path.substr(dot);
+    const auto* iter =
+        std::find_if(types.begin(), types.end(), [&](const auto& type) { return beast::iequals(ext, type.first); });
+
+    return iter == types.end() ? "application/octet-stream" : iter->second;
+}
+
+// An open regular file, closed once nothing is sending it any more
+struct cached_file
+{
+#if defined(_WIN32)
+    // Without `pread`, a read seeks first, so the connections sending the file take turns
+    mutable beast::file handle;
+    mutable std::mutex mutex;
+
+    // to tell whether the path now refers to a different file
+    std::filesystem::file_time_type modified {};
+#else
+    int fd = -1;
+
+    // to tell whether the path now refers to a different file
+    dev_t device = 0;
+    ino_t inode = 0;
+    timespec modified {};
+#endif
+
+    uint64_t size = 0;
+    std::string_view content_type;
+
+    cached_file() = default;
+    cached_file(const cached_file&) = delete;
+    auto operator=(const cached_file&) -> cached_file& = delete;
+    cached_file(cached_file&&) = delete;
+    auto operator=(cached_file&&) -> cached_file& = delete;
+
+    ~cached_file()
+    {
+#if !defined(_WIN32)
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+#endif
+    }
+
+    // Whether `path` still refers to this file, as it was when it was opened
+    [[nodiscard]] auto is_at(const std::string& path) const -> bool
+    {
+#if defined(_WIN32)
+        std::error_code err;
+        const auto current_size = std::filesystem::file_size(path, err);
+        const auto current_modified = std::filesystem::last_write_time(path, err);
+        return not err && current_size == size && current_modified == modified;
+#else
+        struct stat info {};
+        return ::stat(path.c_str(), &info) == 0 && info.st_dev == device && info.st_ino == inode
+            && static_cast<uint64_t>(info.st_size) == size && info.st_mtim.tv_sec == modified.tv_sec
+            && info.st_mtim.tv_nsec == modified.tv_nsec;
+#endif
+    }
+
+    // Up to `count` bytes from `offset` into `data`, or 0 at the end of the file or on an error
+    auto read(uint64_t offset, char* data, size_t count, beast::error_code& err) const -> size_t
+    {
+#if defined(_WIN32)
+        const std::lock_guard lock {mutex};
+        handle.seek(offset, err);
+        return err ? 0 : handle.read(data, count, err);
+#else
+        const auto bytes = ::pread(fd, data, count, static_cast<off_t>(offset));
+        if (bytes < 0)
+        {
+            err = {errno, beast::system_category()};
+            return 0;
+        }
+
+        return static_cast<size_t>(bytes);
+#endif
+    }
+};
+
+// The headers of a response whose body is a file, for the session to send straight from it
+struct file_response
+{
+    http::response<http::empty_body> header;
+
+    // Nothing for a HEAD request
+    std::shared_ptr<const cached_file> file;
+};
+
+// Open files and their stat results, shared by every connection.
+// A path is only stat'ed again once its entry is older than `check_interval`
+class file_cache
+{
+    static constexpr auto check_interval = std::chrono::seconds(1);
+
+    // more than this many entries and the cache starts again, rather than run out of descriptors
+    static constexpr size_t max_entries = 1024;
+
+    struct entry
+    {
+        std::shared_ptr<const cached_file> file;
+        std::chrono::steady_clock::time_point checked;
+    };
+
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, entry> m_entries;
+
+    static auto open(const std::string& path) -> std::shared_ptr<const cached_file>
+    {
+        auto file = std::make_shared<cached_file>();
+
+#if defined(_WIN32)
+        std::error_code err;
+        if (not std::filesystem::is_regular_file(path, err))
+        {
+            return nullptr;
+        }
+
+        beast::error_code open_err;
+        file->handle.open(path.c_str(), beast::file_mode::read, open_err);
+        if (open_err)
+        {
+            return nullptr;
+        }
+
+        file->size = file->handle.size(open_err);
+        file->modified = std::filesystem::last_write_time(path, err);
+        if (open_err || err)
+        {
+            return nullptr;
+        }
+#else
+        file->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);  // NOLINT(*-vararg)
+        if (file->fd < 0)
+        {
+            return nullptr;
+        }
+
+        struct stat info {};
+        if (::fstat(file->fd, &info) != 0 || not S_ISREG(info.st_mode))
+        {
+            return nullptr;
+        }
+
+        file->size = static_cast<uint64_t>(info.st_size);
+        file->device = info.st_dev;
+        file->inode = info.st_ino;
+        file->modified = info.st_mtim;
+#endif
+
+        file->content_type = mime_type(path);
+        return file;
+    }
+
+  public:
+    // Nothing if `path` isn't a regular file that can be read.
+    // The file system is only looked at with the lock released, so a thread checking or opening
+    // a file doesn't hold up the others finding theirs
+    auto find(const std::string& path) -> std::shared_ptr<const cached_file>
+    {
+        const auto now = std::chrono::steady_clock::now();
+
+        std::shared_ptr<const cached_file> cached;
+        {
+            const std::shared_lock lock {m_mutex};
+
+            const auto iter = m_entries.find(path);
+            if (iter != m_entries.end())
+            {
+                if (now - iter->second.checked < check_interval)
+                {
+                    return iter->second.file;
+                }
+
+                cached = iter->second.file;
+            }
+        }
+
+        auto file = cached && cached->is_at(path) ? std::move(cached) : open(path);
+
+        const std::unique_lock lock {m_mutex};
+        if (not file)
+        {
+            m_entries.erase(path);
+            return nullptr;
+        }
+
+        if (m_entries.size() >= max_entries && not m_entries.contains(path))
+        {
+            m_entries.clear();
+        }
+
+        // another thread may have got here first for the same path, and either file will do
+        m_entries.insert_or_assign(path, entry {file, now});
+        return file;
+    }
+};
+
+// Directories served under a path prefix, for requests that no route matched
+class static_file_server
+{
+    struct mount
+    {
+        std::string prefix;
+        std::string root;
+    };
+
+    std::vector<mount> m_mounts;
+    mutable file_cache m_file_cache;
+
+    // The part of `path` under `prefix`, or nothing if it isn't under it or tries to leave it
+    static auto relative_path(std::string_view path, std::string_view prefix) -> std::optional<std::string_view>
+    {
+        if (not path.starts_with(prefix) || path.size() <= prefix.size() + 1 || path[prefix.size()] != '/')
+        {
+            return std::nullopt;
+        }
+
+        const auto relative = path.substr(prefix.size() + 1);
+        if (relative.find_first_of(std::string_view("\\\0", 2)) != std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+
+        auto rest = relative;
+        while (not rest.empty())
+        {
+            const auto part = rest.substr(0, rest.find('/'));
+            if (part.empty() || part == "." || part == "..")
+            {
+                return std::nullopt;
+            }
+
+            rest.remove_prefix(std::min(rest.size(), part.size() + 1));
+        }
+
+        return relative;
+    }
+
+  public:
+    // Serve the files under `root` for GET and HEAD requests to paths under `prefix`
+    void add_static_files(std::string prefix, const std::filesystem::path& root)
+    {
+        if (not std::filesystem::is_directory(root))
+        {
+            throw std::invalid_argument("Static files root is not a directory: " + root.string());
+        }
+
+        m_mounts.push_back({std::move(prefix), std::filesystem::absolute(root).string()});
+    }
+
+    auto find_static_file(const http_request& request) const -> std::optional<file_response>
+    {
+        const auto method = request.beast_request.method();
+        if (method != http::verb::get && method != http::verb::head)
+        {
+            return std::nullopt;
+        }
+
+        for (const auto& mounted : m_mounts)
+        {
+            const auto relative = relative_path(request.path, mounted.prefix);
+            if (not relative)
+            {
+                continue;
+            }
+
+            auto file = m_file_cache.find(mounted.root + '/' + std::string(*relative));
+            if (not file)
+            {
+                continue;
+            }
+
+            file_response response {{http::status::ok, request.beast_request.version()}, nullptr};
+            response.header.set(http::field::content_type, file->content_type);
+            response.header.content_length(file->size);
+            response.header.keep_alive(request.beast_request.keep_alive());
+
+            if (method == http::verb::get)
+            {
+                response.file = std::move(file);
+            }
+
+            return response;
+        }
+
+        return std::nullopt;
+    }
+};
+}  // namespace mech_suit::detail
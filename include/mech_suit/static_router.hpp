@@ -0,0 +1,458 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <boost/beast/http/message_generator.hpp>
+
+#include "mech_suit/body.hpp"
+#include "mech_suit/boost.hpp"
+#include "mech_suit/error_handlers.hpp"
+#include "mech_suit/http_request.hpp"
+#include "mech_suit/meta_string.hpp"
+#include "mech_suit/metrics.hpp"
+#include "mech_suit/route.hpp"
+#include "mech_suit/route_trie.hpp"
+#include "mech_suit/static_files.hpp"
+
+namespace mech_suit
+{
+// A route declared at compile time, for use in a `routes` list.
+// `Handler` is a captureless lambda (or any other constant callable) taking the
+// same arguments as a callback given to `application::add_route`
+template<http::verb Method, meta::string Path, auto Handler, typename Body = no_body_t>
+struct static_route
+{
+    using impl_t = detail::route_impl<Path, Method, Body>;
+
+    static constexpr http::verb method = Method;
+    static constexpr std::string_view path = static_cast<std::string_view>(Path);
+    static constexpr auto handler = Handler;
+
+    // `Handler` is a coroutine, to be awaited by the session
+    static constexpr bool is_async = impl_t::template is_async_callback<decltype(Handler)>;
+
+    static_assert(is_async || impl_t::template is_typed_callback<decltype(Handler)>
+                      || std::is_convertible_v<decltype(Handler), detail::callback_type_t<Path, Method, Body>>,
+                  "Handler can not be called with the params and body of the route");
+};
+
+// Every route of an `application<routes<...>>`, known at compile time
+template<typename... Routes>
+struct routes
+{
+};
+
+// Routes added at runtime with `application::add_route` and friends
+struct dynamic_routes
+{
+};
+}  // namespace mech_suit
+
+namespace mech_suit::detail
+{
+// FNV-1a over the method and path, finished with murmur3's mixer so that
+// the low bits used to pick a slot depend on every bit of the input
+constexpr auto hash_route_key(http::verb method, std::string_view path, uint32_t seed) -> uint32_t
+{
+    constexpr uint32_t prime = 16777619U;
+
+    uint32_t hash = 2166136261U ^ seed;
+    hash = (hash ^ static_cast<uint32_t>(method)) * prime;
+    for (const char chr : path)
+    {
+        hash = (hash ^ static_cast<uint8_t>(chr)) * prime;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+template<typename Routes>
+class static_router;
+
+// Dispatches over a route list fixed at compile time.
+// Explicit routes are found through a perfect hash built at compile time, then
+// called through a chain of constant comparisons the compiler can lower to a
+// jump table. Dynamic routes are tried in the order they are listed.
+// Nothing is virtual and handlers are called directly, so they can be inlined
+template<typename... Routes>
+class static_router<routes<Routes...>>
+    : public router_error_handlers
+    , public static_file_server
+    , public metrics_server
+{
+    static constexpr size_t route_count = sizeof...(Routes);
+
+    static constexpr size_t explicit_count = (size_t {0} + ... + (Routes::impl_t::route_is_explicit ? 1 : 0));
+
+    // hash-and-displace: every key is first hashed into a bucket, then each bucket
+    // gets the seed that puts all of its keys in free slots of the table
+    static constexpr size_t bucket_count = std::max<size_t>(explicit_count, 1);
+    static constexpr size_t slot_count = std::bit_ceil(bucket_count * 2);
+    static constexpr uint16_t empty_slot = route_count;
+
+    static_assert(route_count < UINT16_MAX, "Too many routes");
+
+    static constexpr std::array<bool, route_count> route_is_explicit {Routes::impl_t::route_is_explicit...};
+    static constexpr std::array<http::verb, route_count> route_methods {Routes::method...};
+    static constexpr std::array<std::string_view, route_count> route_paths {Routes::path...};
+
+    struct hash_table
+    {
+        std::array<uint32_t, bucket_count> seeds {};
+        std::array<uint16_t, slot_count> slots {};
+    };
+
+    static constexpr auto build_hash_table() -> hash_table
+    {
+        hash_table table;
+        table.slots.fill(empty_slot);
+
+        std::array<size_t, route_count> bucket_of {};
+        std::array<size_t, bucket_count> bucket_size {};
+        for (size_t i = 0; i < route_count; i++)
+        {
+            if (not route_is_explicit[i])
+            {
+                continue;
+            }
+
+            for (size_t j = 0; j < i; j++)
+            {
+                if (route_is_explicit[j] && route_methods[j] == route_methods[i] && route_paths[j] == route_paths[i])
+                {
+                    throw std::logic_error("The same explicit route is listed twice");
+                }
+            }
+
+            bucket_of[i] = hash_route_key(route_methods[i], route_paths[i], 0) % bucket_count;
+            bucket_size[bucket_of[i]]++;
+        }
+
+        // place the largest buckets first, while the table is emptiest
+        for (size_t size = route_count; size > 0; size--)
+        {
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+            {
+                if (bucket_size[bucket] != size)
+                {
+                    continue;
+                }
+
+                for (uint32_t seed = 1;; seed++)
+                {
+                    auto slots = table.slots;
+                    bool placed = true;
+                    for (size_t i = 0; i < route_count && placed; i++)
+                    {
+                        if (not route_is_explicit[i] || bucket_of[i] != bucket)
+                        {
+                            continue;
+                        }
+
+                        auto& slot = slots[hash_route_key(route_methods[i], route_paths[i], seed) & (slot_count - 1)];
+                        placed = slot == empty_slot;
+                        slot = static_cast<uint16_t>(i);
+                    }
+
+                    if (placed)
+                    {
+                        table.seeds[bucket] = seed;
+                        table.slots = slots;
+                        break;
+                    }
+                }
+            }
+        }
+
+        return table;
+    }
+
+    static constexpr hash_table m_hash_table = build_hash_table();
+
+    static constexpr std::array<bool, route_count> route_is_async {Routes::is_async...};
+
+    static constexpr std::array<bool (*)(std::string_view), route_count> route_accepts_content_type {
+        &Routes::impl_t::accepts_content_type...};
+
+    template<typename Route>
+    auto call(const http_request& request, std::span<const std::string_view> parts) const -> http::message_generator
+    {
+        if constexpr (Route::is_async)
+        {
+            throw std::logic_error("A coroutine route has to be called with handle_request_async");
+        }
+        else
+        {
+            return Route::impl_t::handle_request(
+                Route::handler, request, parts, m_exception_handler, m_glz_parse_error_handler);
+        }
+    }
+
+    template<typename Route>
+    auto call_async(const http_request& request, std::span<const std::string_view> parts) const
+        -> net::awaitable<http::message_generator>
+    {
+        return Route::impl_t::handle_request_async(
+            Route::handler, request, parts, m_exception_handler, m_glz_parse_error_handler);
+    }
+
+    template<typename Route>
+    static auto test_dynamic(http::verb method, std::span<const std::string_view> parts) -> bool
+    {
+        if constexpr (Route::impl_t::route_is_explicit)
+        {
+            return false;
+        }
+        else
+        {
+            return Route::method == method && Route::impl_t::test_match(parts);
+        }
+    }
+
+    template<size_t... Is>
+    static auto find_dynamic(std::index_sequence<Is...> /*unused*/,
+                             http::verb method,
+                             std::span<const std::string_view> parts) -> size_t
+    {
+        size_t route = route_count;
+        static_cast<void>((... || (test_dynamic<Routes>(method, parts) && (route = Is, true))));
+        return route;
+    }
+
+    template<typename Route>
+    static void open_route_stream(const http_request& request,
+                                  std::span<const std::string_view> parts,
+                                  std::optional<stream_handler>& stream)
+    {
+        if constexpr (Route::impl_t::streams_body)
+        {
+            stream.emplace(Route::impl_t::open_stream(Route::handler, request, parts));
+        }
+    }
+
+  public:
+    // The route a request is for, found from its headers alone
+    struct route_match
+    {
+        // `route_count` when no route matched
+        size_t route = route_count;
+        path_parts_t parts {};
+        size_t part_count = 0;
+
+        [[nodiscard]] auto found() const -> bool { return route != route_count; }
+
+        [[nodiscard]] auto matched_parts() const -> std::span<const std::string_view>
+        {
+            return std::span<const std::string_view>(parts).first(part_count);
+        }
+    };
+
+    auto find_route(const http_request& request) const -> route_match
+    {
+        const auto method = request.beast_request.method();
+        route_match match;
+
+        if constexpr (explicit_count > 0)
+        {
+            const auto bucket = hash_route_key(method, request.path, 0) % bucket_count;
+            const auto seed = m_hash_table.seeds[bucket];
+            const auto idx = m_hash_table.slots[hash_route_key(method, request.path, seed) & (slot_count - 1)];
+
+            // a hash hit could still be a path that isn't routed, so compare the key as well
+            if (idx != empty_slot && route_methods[idx] == method && route_paths[idx] == request.path)
+            {
+                match.route = idx;
+                return match;
+            }
+        }
+
+        if constexpr (explicit_count < route_count)
+        {
+            // skip the leading slash
+            auto path = request.path.substr(std::min<size_t>(1, request.path.size()));
+            while (not path.empty() && match.part_count < match.parts.size())
+            {
+                match.parts[match.part_count++] = next_path_part(path);
+            }
+
+            // anything left over is deeper than any route can be
+            if (path.empty())
+            {
+                match.route = find_dynamic(std::index_sequence_for<Routes...>(), method, match.matched_parts());
+            }
+        }
+
+        return match;
+    }
+
+    // Call the matched route now that the whole request has been read
+    auto handle_request(const http_request& request, const route_match& match) const -> http::message_generator
+    {
+        return dispatch(std::index_sequence_for<Routes...>(), request, match);
+    }
+
+    auto handle_request(const http_request& request) const -> http::message_generator
+    {
+        return handle_request(request, find_route(request));
+    }
+
+    // Every route, in the order they are listed
+    [[nodiscard]] static auto route_labels() -> std::vector<route_label>
+    {
+        std::vector<route_label> labels;
+        labels.reserve(route_count);
+        for (size_t i = 0; i < route_count; i++)
+        {
+            labels.push_back({route_methods[i], std::string(route_paths[i])});
+        }
+        return labels;
+    }
+
+    // `match` has to be for one of the routes
+    [[nodiscard]] static auto route_id(const route_match& match) -> size_t { return match.route; }
+
+    auto find_metrics(const http_request& request) const -> std::optional<http::message_generator>
+    {
+        return metrics_response(request, route_labels());
+    }
+
+    auto find_traces(const http_request& request) const -> std::optional<http::message_generator>
+    {
+        return traces_response(request, route_labels());
+    }
+
+    // A matched route with a coroutine callback is called with `handle_request_async`
+    [[nodiscard]] auto is_async(const route_match& match) const -> bool
+    {
+        return match.found() && route_is_async[match.route];
+    }
+
+    // `request` and `match` have to outlive the returned awaitable
+    auto handle_request_async(const http_request& request, const route_match& match) const
+        -> net::awaitable<http::message_generator>
+    {
+        if (not match.found())
+        {
+            co_return handle_unmatched(request, allowed_methods(request));
+        }
+
+        co_return co_await dispatch_async(std::index_sequence_for<Routes...>(), request, match);
+    }
+
+    // Nothing if the matched route reads the whole body before it is called
+    auto open_stream(const http_request& request, const route_match& match) const -> std::optional<stream_handler>
+    {
+        return open_stream(std::index_sequence_for<Routes...>(), request, match);
+    }
+
+    // Whether the matched route can read a body in the Content-Type of `request`
+    auto accepts_content_type(const http_request& request, const route_match& match) const -> bool
+    {
+        return not match.found()
+            || route_accepts_content_type[match.route](request.beast_request[http::field::content_type]);
+    }
+
+    // Every method with a route for the path of `request`
+    auto allowed_methods(const http_request& request) const -> std::vector<http::verb>
+    {
+        std::vector<http::verb> allowed;
+
+        const auto allow = [&](http::verb method)
+        {
+            if (std::find(allowed.begin(), allowed.end(), method) == allowed.end())
+            {
+                allowed.push_back(method);
+            }
+        };
+
+        for (size_t i = 0; i < route_count; i++)
+        {
+            if (route_is_explicit[i] && route_paths[i] == request.path)
+            {
+                allow(route_methods[i]);
+            }
+        }
+
+        if constexpr (explicit_count < route_count)
+        {
+            path_parts_t parts;
+            size_t part_count = 0;
+
+            auto path = request.path.substr(std::min<size_t>(1, request.path.size()));
+            while (not path.empty() && part_count < parts.size())
+            {
+                parts[part_count++] = next_path_part(path);
+            }
+
+            if (path.empty())
+            {
+                const auto matched = std::span<const std::string_view>(parts).first(part_count);
+                static_cast<void>(
+                    (..., (not Routes::impl_t::route_is_explicit && Routes::impl_t::test_match(matched)
+                           && (allow(Routes::method), true))));
+            }
+        }
+
+        return allowed;
+    }
+
+  private:
+    // one constant comparison per route, that the compiler can lower to a jump table
+    template<size_t... Is>
+    auto dispatch(std::index_sequence<Is...> /*unused*/, const http_request& request, const route_match& match) const
+        -> http::message_generator
+    {
+        std::optional<http::message_generator> response;
+        static_cast<void>(
+            (... || (match.route == Is && (response.emplace(call<Routes>(request, match.matched_parts())), true))));
+
+        if (not response)
+        {
+            return handle_unmatched(request, allowed_methods(request));
+        }
+
+        return std::move(*response);
+    }
+
+    // `match` has to be for one of the routes
+    template<size_t... Is>
+    auto dispatch_async(std::index_sequence<Is...> /*unused*/,
+                        const http_request& request,
+                        const route_match& match) const -> net::awaitable<http::message_generator>
+    {
+        std::optional<net::awaitable<http::message_generator>> handler;
+        static_cast<void>(
+            (... || (match.route == Is && (handler.emplace(call_async<Routes>(request, match.matched_parts())), true))));
+
+        return std::move(*handler);
+    }
+
+    template<size_t... Is>
+    auto open_stream(std::index_sequence<Is...> /*unused*/,
+                     const http_request& request,
+                     const route_match& match) const -> std::optional<stream_handler>
+    {
+        std::optional<stream_handler> stream;
+        static_cast<void>(
+            (... || (match.route == Is && (open_route_stream<Routes>(request, match.matched_parts(), stream), true))));
+        return stream;
+    }
+};
+}  // namespace mech_suit::detail
@@ -0,0 +1,227 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "mech_suit/boost.hpp"
+
+namespace mech_suit::detail
+{
+// A point at which something times out, tracked by a `timer_wheel` rather than a timer of its own
+class deadline
+{
+    friend class timer_wheel;
+
+    static constexpr int64_t never = std::numeric_limits<int64_t>::max();
+
+    // In ticks of the wheel. `m_scheduled` is the slot the wheel will look at it in,
+    // so moving the deadline later doesn't touch the wheel at all
+    std::atomic<int64_t> m_expires {never};
+    std::atomic<int64_t> m_scheduled {never};
+
+    // Called on the wheel's thread, so it should only post to wherever the owner runs
+    std::function<void()> m_on_expired;
+
+  public:
+    explicit deadline(std::function<void()> on_expired)
+        : m_on_expired(std::move(on_expired))
+    {
+    }
+};
+
+// Deadlines of every connection of an `io_context`, checked a coarse tick at a time by a single timer.
+// Thousands of idle connections then cost one timer rather than one each
+class timer_wheel : public net::execution_context::service
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto tick = std::chrono::milliseconds(100);
+
+    // A deadline further away than this many ticks is passed over until its round comes
+    static constexpr size_t slots = 1024;
+
+    static inline net::execution_context::id id {};
+
+  private:
+    struct entry
+    {
+        std::weak_ptr<deadline> target;
+        int64_t tick;
+    };
+
+    std::mutex m_mutex;
+    std::array<std::vector<entry>, slots> m_slots {};
+    size_t m_size = 0;
+
+    const clock::time_point m_start = clock::now();
+
+    // The next tick to be looked at
+    int64_t m_next = 0;
+
+    net::steady_timer m_timer;
+    bool m_running = false;
+
+    // Kept between ticks so their memory is reused
+    std::vector<entry> m_due;
+    std::vector<std::shared_ptr<deadline>> m_expired;
+
+    auto ticks(clock::time_point time) const -> int64_t { return (time - m_start) / tick; }
+
+    // With `m_mutex` held
+    void insert(const std::shared_ptr<deadline>& target, int64_t at)
+    {
+        at = std::max(at, m_next);
+        m_slots[static_cast<size_t>(at) % slots].push_back({target, at});
+        target->m_scheduled.store(at);
+        m_size++;
+
+        if (not m_running)
+        {
+            // nothing was due while it was stopped
+            m_next = std::max(m_next, ticks(clock::now()));
+            m_running = true;
+            wait();
+        }
+    }
+
+    // With `m_mutex` held
+    void wait()
+    {
+        m_timer.expires_at(m_start + (tick * m_next));
+        m_timer.async_wait(
+            [this](beast::error_code err)
+            {
+                if (not err)
+                {
+                    on_tick();
+                }
+            });
+    }
+
+    void on_tick()
+    {
+        {
+            const std::lock_guard lock {m_mutex};
+
+            for (const auto now = ticks(clock::now()); m_next <= now; m_next++)
+            {
+                auto& slot = m_slots[static_cast<size_t>(m_next) % slots];
+                std::swap(slot, m_due);
+
+                for (auto& item : m_due)
+                {
+                    // for a later round
+                    if (item.tick != m_next)
+                    {
+                        slot.push_back(std::move(item));
+                        continue;
+                    }
+
+                    m_size--;
+
+                    // gone, or scheduled again for sooner than this
+                    auto target = item.target.lock();
+                    if (not target || target->m_scheduled.load() != item.tick)
+                    {
+                        continue;
+                    }
+
+                    // moved later since it was scheduled, or not set at all for now
+                    const auto expires = target->m_expires.load();
+                    if (expires > m_next)
+                    {
+                        insert(target, expires == deadline::never ? m_next + static_cast<int64_t>(slots) : expires);
+                        continue;
+                    }
+
+                    target->m_scheduled.store(deadline::never);
+                    m_expired.push_back(std::move(target));
+                }
+
+                m_due.clear();
+            }
+
+            if (m_size == 0)
+            {
+                m_running = false;
+            }
+            else
+            {
+                wait();
+            }
+        }
+
+        // outside the lock, so that they may set their deadlines again
+        for (const auto& target : m_expired)
+        {
+            target->m_on_expired();
+        }
+        m_expired.clear();
+    }
+
+  public:
+    explicit timer_wheel(net::io_context& ioc)
+        : net::execution_context::service(ioc)
+        , m_timer(ioc)
+    {
+    }
+
+    // Set `target`, a member of `owner`, to expire `duration` from now. Rounded up to
+    // the next tick, so it never expires early.
+    // Unless that is sooner than before, this only stores the new value
+    template<typename Owner>
+    void expires_after(Owner& owner, deadline& target, clock::duration duration)
+    {
+        target.m_expires.store(ticks(clock::now() + duration) + 1);
+        schedule(owner, target);
+    }
+
+    // Make sure the wheel will look at `target` by the time it expires, e.g. after it was
+    // found to have been moved later once it had already been taken off the wheel
+    template<typename Owner>
+    void schedule(Owner& owner, deadline& target)
+    {
+        const auto expires = target.m_expires.load();
+        if (expires == deadline::never || expires >= target.m_scheduled.load())
+        {
+            return;
+        }
+
+        const std::lock_guard lock {m_mutex};
+        insert(std::shared_ptr<deadline>(owner.shared_from_this(), &target), expires);
+    }
+
+    static void cancel(deadline& target) { target.m_expires.store(deadline::never); }
+
+    [[nodiscard]] auto expired(const deadline& target) const -> bool
+    {
+        return target.m_expires.load() <= ticks(clock::now());
+    }
+
+    void shutdown() override
+    {
+        const std::lock_guard lock {m_mutex};
+        for (auto& slot : m_slots)
+        {
+            slot.clear();
+        }
+        m_size = 0;
+    }
+};
+
+// The wheel of the `io_context` that `executor` belongs to
+template<typename Executor>
+auto timer_wheel_of(const Executor& executor) -> timer_wheel&
+{
+    return net::use_service<timer_wheel>(static_cast<net::io_context&>(net::query(executor, net::execution::context)));
+}
+}  // namespace mech_suit::detail
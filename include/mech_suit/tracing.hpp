@@ -0,0 +1,392 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mech_suit/route_label.hpp"
+
+namespace mech_suit::detail
+{
+// When a request got through each stage of being served
+struct request_trace
+{
+    // In the order they happen. The time up to a stage is named for it in `names`
+    enum stage : size_t
+    {
+        // The connection, for the first request on it only. How long it waited to be accepted isn't known
+        accepted,
+        // Reading the request, from its first byte if the connection was idle
+        started,
+        headers_read,
+        // Only for a body that is read before the route is called
+        body_read,
+        // Only for a body that is parsed into a value
+        body_parsed,
+        // By the route, or whatever else answered the request
+        handled,
+        // Once the responses ahead of it have been written
+        write_started,
+        written,
+        stage_count,
+    };
+
+    static constexpr std::array<std::string_view, stage_count> names {
+        "", "accept", "headers", "body_read", "body_parse", "handler", "queued", "write"};
+
+    // Nanoseconds on the steady clock, 0 for a stage the request didn't go through
+    std::array<int64_t, stage_count> at {};
+
+    static auto now() -> int64_t
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void mark(stage point) { at[point] = now(); }
+
+    // When the first stage it went through happened
+    [[nodiscard]] auto start() const -> int64_t
+    {
+        const auto iter = std::find_if(at.begin(), at.end(), [](int64_t time) { return time != 0; });
+        return iter == at.end() ? 0 : *iter;
+    }
+
+    [[nodiscard]] auto duration() const -> int64_t { return at[written] == 0 ? 0 : at[written] - start(); }
+
+    // The time up to `point` from the stage before it that the request went through
+    [[nodiscard]] auto duration(stage point) const -> int64_t
+    {
+        if (at[point] == 0)
+        {
+            return 0;
+        }
+
+        for (auto i = static_cast<size_t>(point); i > 0; i--)
+        {
+            if (at[i - 1] != 0)
+            {
+                return at[point] - at[i - 1];
+            }
+        }
+
+        return 0;
+    }
+};
+
+// Only a request that is traced has a trace to mark
+inline void mark_stage(request_trace* trace, request_trace::stage point)
+{
+    if (trace != nullptr)
+    {
+        trace->mark(point);
+    }
+}
+
+// The traces of the last requests written by each thread, in a ring buffer per thread.
+// A thread only writes to its own ring, without a lock. The rings are read while they are
+// written to, so each slot has a sequence number to tell when a read of it was torn
+class tracer
+{
+    struct slot
+    {
+        // Odd while the slot is written to, 0 until it first is
+        std::atomic<uint64_t> sequence {0};
+        std::atomic<size_t> route {0};
+        std::atomic<unsigned> status {0};
+        std::array<std::atomic<int64_t>, request_trace::stage_count> at {};
+    };
+
+    struct ring
+    {
+        std::thread::id thread;
+
+        // Which thread it is in a dump
+        size_t index;
+
+        std::atomic<uint64_t> written {0};
+        std::vector<slot> slots;
+
+        ring(size_t ring_index, size_t capacity)
+            : thread(std::this_thread::get_id())
+            , index(ring_index)
+            , slots(capacity)
+        {
+        }
+    };
+
+    // Tells the rings of different instances apart, even at the same address
+    static inline std::atomic<uint64_t> s_next_instance {1};
+    const uint64_t m_instance = s_next_instance.fetch_add(1);
+
+    // The ring of the calling thread, for the instance it was last looked up for
+    static inline thread_local uint64_t t_instance = 0;
+    static inline thread_local ring* t_ring = nullptr;
+
+    size_t m_capacity;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<ring>> m_rings;
+
+    auto local() -> ring&
+    {
+        if (t_instance == m_instance)
+        {
+            return *t_ring;
+        }
+
+        const std::lock_guard lock {m_mutex};
+
+        auto iter = std::find_if(m_rings.begin(),
+                                 m_rings.end(),
+                                 [](const auto& item) { return item->thread == std::this_thread::get_id(); });
+        if (iter == m_rings.end())
+        {
+            m_rings.push_back(std::make_unique<ring>(m_rings.size(), m_capacity));
+            iter = std::prev(m_rings.end());
+        }
+
+        t_instance = m_instance;
+        t_ring = iter->get();
+        return **iter;
+    }
+
+    static auto label_of(std::span<const route_label> labels, size_t route)
+        -> std::pair<std::string_view, std::string_view>
+    {
+        if (route >= labels.size() || labels[route].method == http::verb::unknown)
+        {
+            return {"", route < labels.size() ? std::string_view(labels[route].path) : std::string_view()};
+        }
+
+        return {http::to_string(labels[route].method), labels[route].path};
+    }
+
+    // As microseconds, to the nanosecond
+    static void append_micros(std::string& out, int64_t nanos)
+    {
+        constexpr int64_t nanos_per_micro = 1000;
+
+        const auto fraction = std::to_string(nanos % nanos_per_micro);
+        out += std::to_string(nanos / nanos_per_micro);
+        out += '.';
+        out.append(3 - fraction.size(), '0');
+        out += fraction;
+    }
+
+    static void append_json_string(std::string& out, std::string_view text)
+    {
+        out += '"';
+        for (const auto chr : text)
+        {
+            if (chr == '"' || chr == '\\')
+            {
+                out += '\\';
+            }
+            out += chr;
+        }
+        out += '"';
+    }
+
+  public:
+    static constexpr size_t default_capacity = 4096;
+
+    struct traced_request
+    {
+        size_t route = 0;
+        unsigned status = 0;
+
+        // The ring it was found in, one per thread
+        size_t thread = 0;
+
+        request_trace trace;
+    };
+
+    // Keep the last `capacity` requests of each thread
+    explicit tracer(size_t capacity = default_capacity)
+        : m_capacity(std::max<size_t>(capacity, 1))
+    {
+    }
+
+    // Once the response to the request has been written
+    void record(size_t route, unsigned status, const request_trace& trace)
+    {
+        auto& local = this->local();
+        const auto count = local.written.load(std::memory_order_relaxed);
+        auto& entry = local.slots[count % local.slots.size()];
+
+        const auto sequence = entry.sequence.load(std::memory_order_relaxed);
+        entry.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        entry.route.store(route, std::memory_order_relaxed);
+        entry.status.store(status, std::memory_order_relaxed);
+        for (size_t i = 0; i < trace.at.size(); i++)
+        {
+            entry.at[i].store(trace.at[i], std::memory_order_relaxed);
+        }
+
+        entry.sequence.store(sequence + 2, std::memory_order_release);
+        local.written.store(count + 1, std::memory_order_release);
+    }
+
+    // The `count` slowest of the requests still in the rings, slowest first
+    auto slowest(size_t count) -> std::vector<traced_request>
+    {
+        std::vector<traced_request> requests;
+
+        {
+            const std::lock_guard lock {m_mutex};
+            for (const auto& thread_ring : m_rings)
+            {
+                for (const auto& current : thread_ring->slots)
+                {
+                    const auto sequence = current.sequence.load(std::memory_order_acquire);
+                    if (sequence == 0 || sequence % 2 == 1)
+                    {
+                        continue;
+                    }
+
+                    traced_request request {current.route.load(std::memory_order_relaxed),
+                                            current.status.load(std::memory_order_relaxed),
+                                            thread_ring->index,
+                                            {}};
+                    for (size_t i = 0; i < request.trace.at.size(); i++)
+                    {
+                        request.trace.at[i] = current.at[i].load(std::memory_order_relaxed);
+                    }
+
+                    // written to again while it was read
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (current.sequence.load(std::memory_order_relaxed) != sequence)
+                    {
+                        continue;
+                    }
+
+                    requests.push_back(request);
+                }
+            }
+        }
+
+        count = std::min(count, requests.size());
+        std::partial_sort(requests.begin(),
+                          requests.begin() + static_cast<std::ptrdiff_t>(count),
+                          requests.end(),
+                          [](const auto& lhs, const auto& rhs) { return lhs.trace.duration() > rhs.trace.duration(); });
+        requests.resize(count);
+        return requests;
+    }
+
+    // A line per request, with the time it spent in each stage.
+    // `labels` are those of every route id
+    static auto text(std::span<const traced_request> requests, std::span<const route_label> labels) -> std::string
+    {
+        std::string out = "# microseconds, slowest first\ntotal";
+        for (size_t stage = request_trace::started; stage < request_trace::stage_count; stage++)
+        {
+            out += ' ';
+            out += request_trace::names[stage];
+        }
+        out += " thread status method route\n";
+
+        for (const auto& request : requests)
+        {
+            append_micros(out, request.trace.duration());
+            for (size_t stage = request_trace::started; stage < request_trace::stage_count; stage++)
+            {
+                out += ' ';
+                append_micros(out, request.trace.duration(static_cast<request_trace::stage>(stage)));
+            }
+
+            const auto [method, path] = label_of(labels, request.route);
+            out += ' ' + std::to_string(request.thread) + ' ' + std::to_string(request.status) + ' ';
+            out += method.empty() ? "-" : method;
+            out += ' ';
+            out += path.empty() ? "-" : path;
+            out += '\n';
+        }
+
+        return out;
+    }
+
+    // In the Chrome trace event format, to be opened in chrome://tracing or Perfetto.
+    // Each request is a row of its own, named for its route and status
+    static auto chrome_trace(std::span<const traced_request> requests, std::span<const route_label> labels)
+        -> std::string
+    {
+        int64_t origin = 0;
+        for (const auto& request : requests)
+        {
+            const auto start = request.trace.start();
+            origin = origin == 0 ? start : std::min(origin, start);
+        }
+
+        std::string out = R"({"displayTimeUnit":"ms","traceEvents":[)";
+        bool first = true;
+
+        const auto event =
+            [&](size_t row, std::string_view name, std::string_view phase, int64_t start, int64_t duration)
+        {
+            out += first ? "\n" : ",\n";
+            first = false;
+
+            out += R"({"name":)";
+            append_json_string(out, name);
+            out += R"(,"ph":")";
+            out += phase;
+            out += R"(","pid":1,"tid":)" + std::to_string(row);
+            if (phase == "X")
+            {
+                out += R"(,"ts":)";
+                append_micros(out, start - origin);
+                out += R"(,"dur":)";
+                append_micros(out, duration);
+            }
+        };
+
+        for (size_t row = 0; row < requests.size(); row++)
+        {
+            const auto& request = requests[row];
+            const auto [method, path] = label_of(labels, request.route);
+
+            event(row, "thread_name", "M", 0, 0);
+            out += R"(,"args":{"name":)";
+            append_json_string(out,
+                               std::string(method) + ' ' + std::string(path) + ' '
+                                   + std::to_string(request.status));
+            out += "}}";
+
+            event(row, "request", "X", request.trace.start(), request.trace.duration());
+            out += R"(,"args":{"thread":)" + std::to_string(request.thread) + "}}";
+
+            for (size_t stage = request_trace::started; stage < request_trace::stage_count; stage++)
+            {
+                const auto point = static_cast<request_trace::stage>(stage);
+                const auto duration = request.trace.duration(point);
+                if (duration == 0)
+                {
+                    continue;
+                }
+
+                event(row, request_trace::names[stage], "X", request.trace.at[stage] - duration, duration);
+                out += '}';
+            }
+        }
+
+        out += "\n]}\n";
+        return out;
+    }
+};
+}  // namespace mech_suit::detail
@@ -1,5 +1,8 @@
 #include "mech_suit/mech_suit.hpp"
 
+#include <filesystem>
+#include <fstream>
+
 #include <boost/beast/http/message_generator.hpp>
 #include <catch2/catch_test_macros.hpp>
 
@@ -43,6 +46,1479 @@ TEST_CASE("Can define a body struct", "[library]")
     app.post<"/users/:long(id)", mech_suit::body_json<foo>>(
         [](const mech_suit::http_request&, long, const foo&) -> mech_suit::http::message_generator {});
 
-    app.post<"/", mech_suit::body_string>(
+    app.post<"/text", mech_suit::body_string>(
         [](const mech_suit::http_request&, std::string_view) -> mech_suit::http::message_generator {});
 }
+
+namespace
+{
+auto make_request(mech_suit::http::verb method, std::string_view target) -> mech_suit::http_request
+{
+    return mech_suit::http_request {mech_suit::http_request::beast_request_t {method, target, 11}};
+}
+
+auto respond(const mech_suit::http_request& request) -> mech_suit::http::message_generator
+{
+    return mech_suit::http::response<mech_suit::http::string_body> {mech_suit::http::status::ok,
+                                                                     request.beast_request.version()};
+}
+}  // namespace
+
+TEST_CASE("Dynamic routes are matched by their path parts", "[router]")
+{
+    using mech_suit::http::verb;
+
+    std::string matched;
+    mech_suit::detail::router router;
+
+    router.add_route<"/users/:int(id)", verb::get>(
+        [&](const mech_suit::http_request& request, int id)
+        {
+            matched = "int " + std::to_string(id);
+            return respond(request);
+        });
+
+    router.add_route<"/users/:string(name)", verb::get>(
+        [&](const mech_suit::http_request& request, std::string_view name)
+        {
+            matched = "string " + std::string(name);
+            return respond(request);
+        });
+
+    router.add_route<"/users/me", verb::get>(
+        [&](const mech_suit::http_request& request)
+        {
+            matched = "me";
+            return respond(request);
+        });
+
+    router.add_route<"/users/:int(id)/posts/latest", verb::get>(
+        [&](const mech_suit::http_request& request, int id)
+        {
+            matched = "latest " + std::to_string(id);
+            return respond(request);
+        });
+
+    router.add_route<"/users/:string(name)/posts", verb::get>(
+        [&](const mech_suit::http_request& request, std::string_view name)
+        {
+            matched = "posts " + std::string(name);
+            return respond(request);
+        });
+
+    router.add_not_found_handler(
+        [&](const mech_suit::http_request& request)
+        {
+            matched = "not found";
+            return respond(request);
+        });
+
+    router.add_method_not_allowed_handler(
+        [&](const mech_suit::http_request& request, std::span<const verb> allowed)
+        {
+            matched = "not allowed";
+            for (const auto method : allowed)
+            {
+                matched += " " + std::string(mech_suit::http::to_string(method));
+            }
+            return respond(request);
+        });
+
+    const auto match = [&](verb method, std::string_view target)
+    {
+        router.handle_request(make_request(method, target));
+        return matched;
+    };
+
+    CHECK(match(verb::get, "/users/me") == "me");
+    CHECK(match(verb::get, "/users/42") == "int 42");
+    CHECK(match(verb::get, "/users/bob") == "string bob");
+    CHECK(match(verb::get, "/users/42/posts/latest") == "latest 42");
+    CHECK(match(verb::get, "/users/42/posts") == "posts 42");
+    CHECK(match(verb::get, "/users/bob/posts/latest") == "not found");
+    CHECK(match(verb::get, "/users") == "not found");
+    CHECK(match(verb::post, "/users/42") == "not allowed GET");
+    CHECK(match(verb::delete_, "/users/me") == "not allowed GET");
+
+    // a route with the same method and an equivalent path is refused, rather than dropped
+    const auto routes = router.route_labels().size();
+    CHECK_THROWS_AS((router.add_route<"/users/:int(other)", verb::get>(
+                        [](const mech_suit::http_request& request, int) { return respond(request); })),
+                    std::invalid_argument);
+    CHECK_THROWS_AS((router.add_route<"/users/me", verb::get>(
+                        [](const mech_suit::http_request& request) { return respond(request); },
+                        mech_suit::route_options {.cache = mech_suit::cache_options {}})),
+                    std::invalid_argument);
+    CHECK(router.route_labels().size() == routes);
+    CHECK(match(verb::get, "/users/42") == "int 42");
+    CHECK(match(verb::get, "/users/me") == "me");
+}
+
+TEST_CASE("Every path param is parsed from the matched parts", "[router]")
+{
+    using mech_suit::http::verb;
+
+    std::string matched;
+    mech_suit::detail::router router;
+
+    router.add_route<"/users/:int(id)/posts/:int(post)/:bool(draft)", verb::get>(
+        [&](const mech_suit::http_request& request, int id, int post, bool draft)
+        {
+            matched = std::to_string(id) + " " + std::to_string(post) + " " + (draft ? "draft" : "published");
+            return respond(request);
+        });
+
+    router.add_route<"/:string(a)/:string(b)", verb::get>(
+        [&](const mech_suit::http_request& request, std::string_view a, std::string_view b)
+        {
+            matched = std::string(a) + " " + std::string(b);
+            return respond(request);
+        });
+
+    router.handle_request(make_request(verb::get, "/users/42/posts/7/yes"));
+    CHECK(matched == "42 7 draft");
+
+    router.handle_request(make_request(verb::get, "/users/1/posts/2/false?query=1"));
+    CHECK(matched == "1 2 published");
+
+    router.handle_request(make_request(verb::get, "/left/right/"));
+    CHECK(matched == "left right");
+}
+
+namespace
+{
+std::string static_matched;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+auto static_respond(const mech_suit::http_request& request, std::string matched) -> mech_suit::http::message_generator
+{
+    static_matched = std::move(matched);
+    return respond(request);
+}
+
+using static_api = mech_suit::routes<
+    mech_suit::static_route<mech_suit::http::verb::get,
+                            "/",
+                            [](const mech_suit::http_request& request) { return static_respond(request, "root"); }>,
+    mech_suit::static_route<mech_suit::http::verb::get,
+                            "/users/me",
+                            [](const mech_suit::http_request& request) { return static_respond(request, "me"); }>,
+    mech_suit::static_route<mech_suit::http::verb::post,
+                            "/users/me",
+                            [](const mech_suit::http_request& request, std::string_view body)
+                            { return static_respond(request, "post " + std::string(body)); },
+                            mech_suit::body_string>,
+    mech_suit::static_route<mech_suit::http::verb::get,
+                            "/users/:int(id)/posts/:int(post)",
+                            [](const mech_suit::http_request& request, int id, int post)
+                            { return static_respond(request, std::to_string(id) + " " + std::to_string(post)); }>>;
+}  // namespace
+
+TEST_CASE("A compile time route list is dispatched without a runtime table", "[router]")
+{
+    using mech_suit::http::verb;
+
+    mech_suit::detail::static_router<static_api> router;
+    router.add_not_found_handler(
+        [](const mech_suit::http_request& request) { return static_respond(request, "not found"); });
+    router.add_method_not_allowed_handler([](const mech_suit::http_request& request, std::span<const verb> allowed)
+                                          { return static_respond(request, std::to_string(allowed.size()) + " allowed"); });
+
+    const auto match = [&](verb method, std::string_view target)
+    {
+        router.handle_request(make_request(method, target));
+        return static_matched;
+    };
+
+    CHECK(match(verb::get, "/") == "root");
+    CHECK(match(verb::get, "/users/me") == "me");
+    CHECK(match(verb::get, "/users/12/posts/34") == "12 34");
+    CHECK(match(verb::get, "/users/you") == "not found");
+    CHECK(match(verb::delete_, "/users/me") == "2 allowed");
+    CHECK(match(verb::put, "/users/12/posts/34") == "1 allowed");
+
+    auto post = make_request(verb::post, "/users/me");
+    post.beast_request.body() = "hello";
+    router.handle_request(std::move(post));
+    CHECK(static_matched == "post hello");
+
+    mech_suit::application<static_api> app;
+}
+
+TEST_CASE("A route matches each part of a path against its declaration", "[route]")
+{
+    using route_t = mech_suit::detail::route_impl<"/users/:int(id)/posts/:bool(draft)",
+                                                  mech_suit::http::verb::get,
+                                                  mech_suit::no_body_t>;
+
+    using parts_t = std::vector<std::string_view>;
+
+    CHECK(route_t::test_match(parts_t {"users", "1", "posts", "true"}));
+    CHECK(route_t::test_match(parts_t {"users", "12", "posts", "no"}));
+    CHECK_FALSE(route_t::test_match(parts_t {"users", "x", "posts", "true"}));
+    CHECK_FALSE(route_t::test_match(parts_t {"users", "1", "post", "true"}));
+    CHECK_FALSE(route_t::test_match(parts_t {"users", "1", "posts", "maybe"}));
+    CHECK_FALSE(route_t::test_match(parts_t {"users", "1", "posts"}));
+}
+
+TEST_CASE("Routes can be registered under a runtime path of the same shape", "[router]")
+{
+    using mech_suit::http::verb;
+
+    std::string matched;
+    mech_suit::detail::router router;
+
+    // the path is copied, so it can be built in place
+    router.add_route_at<"/tenant/0/:int(id)", verb::get>("/tenant/" + std::to_string(7) + "/:int(id)",
+                                                          [&](const mech_suit::http_request& request, int id)
+                                                          {
+                                                              matched = "tenant 7 " + std::to_string(id);
+                                                              return respond(request);
+                                                          });
+
+    router.add_route_at<"/health/0", verb::get>("/health/7",
+                                                [&](const mech_suit::http_request& request)
+                                                {
+                                                    matched = "health 7";
+                                                    return respond(request);
+                                                });
+
+    router.handle_request(make_request(verb::get, "/tenant/7/3"));
+    CHECK(matched == "tenant 7 3");
+
+    router.handle_request(make_request(verb::get, "/health/7"));
+    CHECK(matched == "health 7");
+
+    CHECK_THROWS_AS((router.add_route_at<"/tenant/0/:int(id)", verb::get>(
+                        "/tenant/7", [](const mech_suit::http_request& request, int) { return respond(request); })),
+                    std::invalid_argument);
+}
+
+TEST_CASE("A request keeps its headers and body in its arena until it is cleared", "[request]")
+{
+    using mech_suit::http::verb;
+
+    mech_suit::detail::arena memory;
+    mech_suit::http_request request {memory};
+
+    const auto read_request = [&](std::string_view target, std::string_view body)
+    {
+        request.clear();
+        memory.reset();
+
+        auto& req = request.beast_request;
+        req.method(verb::post);
+        req.target(target);
+        for (int i = 0; i < 32; i++)
+        {
+            req.insert("x-forwarded-" + std::to_string(i), "value");
+        }
+        req.body().assign(body.data(), body.size());
+        request.parse_target();
+
+        return static_cast<const void*>(req.body().data());
+    };
+
+    const auto* first = read_request("/users/1", "a body too long for a small string to hold it");
+    CHECK(request.path == "/users/1");
+    CHECK(request.beast_request["x-forwarded-31"] == "value");
+
+    // the memory of the first request is reused by the second
+    CHECK(read_request("/users/2", "a body that is just as long as the first one!") == first);
+    CHECK(request.path == "/users/2");
+    CHECK(request.beast_request.body() == "a body that is just as long as the first one!");
+
+    // nothing is kept of memory that the arena is about to reuse
+    request.clear();
+    CHECK(request.beast_request.body().data() != first);
+}
+
+TEST_CASE("Every request on a kept alive connection reads its own body", "[request]")
+{
+    using mech_suit::tcp;
+    namespace http = mech_suit::http;
+
+    const auto address = mech_suit::net::ip::make_address("127.0.0.1");
+
+    // a port that is free, for now
+    uint16_t port = 0;
+    {
+        mech_suit::net::io_context ioc;
+        tcp::acceptor probe {ioc, tcp::endpoint {address, 0}};
+        port = probe.local_endpoint().port();
+    }
+
+    mech_suit::application app {mech_suit::config {.address = "127.0.0.1", .port = port, .num_threads = 1}};
+    app.post<"/echo", mech_suit::body_string>(
+        [](const mech_suit::http_request& request, const std::string& body) -> http::message_generator
+        {
+            http::response<http::string_body> response {http::status::ok, request.beast_request.version()};
+            response.keep_alive(request.beast_request.keep_alive());
+            response.body() = body;
+            response.prepare_payload();
+            return response;
+        });
+    std::thread server([&] { app.run(); });
+
+    mech_suit::net::io_context ioc;
+    tcp::socket socket {ioc};
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    mech_suit::beast::error_code err;
+    do
+    {
+        socket.close(err);
+        socket.connect(tcp::endpoint {address, port}, err);
+    } while (err && std::chrono::steady_clock::now() < give_up);
+    REQUIRE_FALSE(err);
+
+    // small bodies are read into the arena's blocks, and big ones into allocations of their own
+    // that the arena frees between requests. A body short enough for the string itself would
+    // be copied into whatever buffer the last one left behind
+    const std::vector<std::string> bodies {std::string(100, 'a'),
+                                           "short",
+                                           std::string(20000, 'b'),
+                                           "short again",
+                                           std::string(100, 'c'),
+                                           std::string(15000, 'd')};
+    mech_suit::beast::flat_buffer buffer;
+    for (const auto& body : bodies)
+    {
+        http::request<http::string_body> request {http::verb::post, "/echo", 11};
+        request.set(http::field::host, "localhost");
+        request.body() = body;
+        request.prepare_payload();
+        http::write(socket, request);
+
+        http::response<http::string_body> response;
+        http::read(socket, buffer, response, err);
+        REQUIRE_FALSE(err);
+        CHECK(response.body() == body);
+    }
+
+    socket.close(err);
+    app.stop();
+    server.join();
+}
+
+TEST_CASE("A streamed body is handed to its route a chunk at a time", "[router]")
+{
+    using mech_suit::http::verb;
+
+    std::string received;
+    mech_suit::detail::router router;
+
+    router.add_route<"/uploads/:int(id)", verb::post, mech_suit::body_stream>(
+        [&](const mech_suit::http_request& request, int id)
+        {
+            received = std::to_string(id) + ":";
+            return mech_suit::stream_handler {[&](std::string_view chunk) { received += chunk; },
+                                              [&request] { return respond(request); }};
+        });
+
+    router.add_route<"/uploads", verb::post, mech_suit::body_string>(
+        [](const mech_suit::http_request& request, std::string_view) { return respond(request); });
+
+    auto request = make_request(verb::post, "/uploads/3");
+
+    // the route is found and opened from the headers alone
+    const auto match = router.find_route(request);
+    auto stream = router.open_stream(request, match);
+    REQUIRE(stream);
+    stream->on_chunk("first ");
+    stream->on_chunk("second");
+    stream->on_end();
+    CHECK(received == "3:first second");
+
+    const auto buffered = make_request(verb::post, "/uploads");
+    CHECK_FALSE(router.open_stream(buffered, router.find_route(buffered)));
+
+    // a body that was read in full is streamed as one chunk
+    request.beast_request.body() = "whole";
+    router.handle_request(request);
+    CHECK(received == "3:whole");
+}
+
+TEST_CASE("A coroutine route is awaited instead of being called", "[router]")
+{
+    using mech_suit::http::verb;
+
+    std::string matched;
+    mech_suit::detail::router router;
+
+    router.add_route<"/users/:int(id)", verb::post, mech_suit::body_string>(
+        [&](const mech_suit::http_request& request,
+            int id,
+            const std::string& body) -> mech_suit::net::awaitable<mech_suit::http::message_generator>
+        {
+            mech_suit::net::steady_timer timer {co_await mech_suit::net::this_coro::executor};
+            co_await timer.async_wait(mech_suit::net::use_awaitable);
+
+            matched = std::to_string(id) + " " + body;
+            co_return respond(request);
+        });
+
+    router.add_route<"/users/:int(id)", verb::get>(
+        [&](const mech_suit::http_request& request, int) { return respond(request); });
+
+    auto request = make_request(verb::post, "/users/5");
+    request.beast_request.body() = "async";
+
+    const auto match = router.find_route(request);
+    CHECK(router.is_async(match));
+    CHECK_FALSE(router.is_async(router.find_route(make_request(verb::get, "/users/5"))));
+    CHECK_THROWS_AS(router.handle_request(request, match), std::logic_error);
+
+    mech_suit::net::io_context ioc;
+    mech_suit::net::co_spawn(
+        ioc,
+        [&]() -> mech_suit::net::awaitable<void> { co_await router.handle_request_async(request, match); },
+        mech_suit::net::detached);
+
+    ioc.run();
+    CHECK(matched == "5 async");
+}
+
+TEST_CASE("Work run on a pool resumes on the thread that awaited it", "[offload]")
+{
+    mech_suit::net::io_context ioc;
+    mech_suit::net::thread_pool pool {1};
+
+    std::thread::id worker;
+    std::thread::id resumed;
+    int result = 0;
+    bool rethrown = false;
+
+    mech_suit::net::co_spawn(
+        ioc,
+        [&]() -> mech_suit::net::awaitable<void>
+        {
+            result = co_await mech_suit::run_on(pool,
+                                                [&]
+                                                {
+                                                    worker = std::this_thread::get_id();
+                                                    return 42;
+                                                });
+            resumed = std::this_thread::get_id();
+
+            try
+            {
+                co_await mech_suit::run_on(pool, []() -> int { throw std::runtime_error("failed"); });
+            }
+            catch (const std::runtime_error&)
+            {
+                rethrown = true;
+            }
+        },
+        mech_suit::net::detached);
+
+    ioc.run();
+    pool.join();
+
+    CHECK(result == 42);
+    CHECK(worker != std::this_thread::get_id());
+    CHECK(resumed == std::this_thread::get_id());
+    CHECK(rethrown);
+}
+
+TEST_CASE("Static files are found under their prefix and nowhere else", "[static_files]")
+{
+    using mech_suit::http::verb;
+
+    const auto root = std::filesystem::temp_directory_path() / "mech_suit_static_files_test";
+    std::filesystem::create_directories(root / "js");
+    std::ofstream(root / "js" / "app.js") << "console.log(1);";
+
+    mech_suit::detail::static_file_server server;
+    server.add_static_files("/assets", root);
+    CHECK_THROWS(server.add_static_files("/missing", root / "missing"));
+
+    mech_suit::detail::arena memory;
+    mech_suit::http_request request {memory};
+
+    const auto find = [&](verb method, std::string_view target)
+    {
+        request.clear();
+        request.beast_request.method(method);
+        request.beast_request.target(target);
+        request.parse_target();
+        return server.find_static_file(request);
+    };
+
+    auto response = find(verb::get, "/assets/js/app.js");
+    REQUIRE(response);
+    CHECK(response->header[mech_suit::http::field::content_type] == "application/javascript");
+    CHECK(response->header[mech_suit::http::field::content_length] == "15");
+    REQUIRE(response->file);
+    CHECK(response->file->size == 15);
+
+    // the same file is shared rather than opened again
+    CHECK(find(verb::get, "/assets/js/app.js")->file == response->file);
+
+    // read from anywhere in it, without a position of its own to share
+    std::array<char, 32> chunk {};
+    mech_suit::beast::error_code err;
+    CHECK(response->file->read(8, chunk.data(), chunk.size(), err) == 7);
+    CHECK(std::string_view(chunk.data(), 7) == "log(1);");
+    CHECK(response->file->read(15, chunk.data(), chunk.size(), err) == 0);
+    CHECK_FALSE(err);
+
+    // nothing to send for HEAD
+    response = find(verb::head, "/assets/js/app.js");
+    REQUIRE(response);
+    CHECK_FALSE(response->file);
+
+    CHECK_FALSE(find(verb::post, "/assets/js/app.js"));
+    CHECK_FALSE(find(verb::get, "/assets/js"));
+    CHECK_FALSE(find(verb::get, "/assets/js/missing.js"));
+    CHECK_FALSE(find(verb::get, "/assetsjs/app.js"));
+    CHECK_FALSE(find(verb::get, "/assets/../mech_suit_static_files_test/js/app.js"));
+    CHECK_FALSE(find(verb::get, "/assets/js/./app.js"));
+    CHECK_FALSE(find(verb::get, "/assets//js/app.js"));
+
+    CHECK(mech_suit::detail::mime_type("a/b.min.CSS") == "text/css");
+    CHECK(mech_suit::detail::mime_type("a.d/README") == "application/octet-stream");
+
+    std::filesystem::remove_all(root);
+}
+
+TEST_CASE("A cached route responds to the same target without being called again", "[response_cache]")
+{
+    using mech_suit::http::verb;
+    using cached_t = std::shared_ptr<const mech_suit::detail::cached_response>;
+
+    int calls = 0;
+    mech_suit::detail::router router;
+
+    router.add_route<"/stats/:int(id)", verb::get>(
+        [&](const mech_suit::http_request& request, int id) -> mech_suit::http::message_generator
+        {
+            calls++;
+            mech_suit::http::response<mech_suit::http::string_body> response {
+                id == 0 ? mech_suit::http::status::not_found : mech_suit::http::status::ok,
+                request.beast_request.version()};
+            response.body() = "stats " + std::to_string(id) + " " + std::to_string(calls);
+            response.prepare_payload();
+            return response;
+        },
+        mech_suit::cache_options {.ttl = std::chrono::hours(1)});
+
+    const auto respond_to = [&](std::string_view target)
+    {
+        auto response = router.handle_request(make_request(verb::get, target));
+        REQUIRE(std::holds_alternative<cached_t>(response));
+        return std::get<cached_t>(std::move(response));
+    };
+
+    const auto first = respond_to("/stats/1");
+    CHECK(first->bytes.starts_with("HTTP/1.1 200 OK\r\n"));
+    CHECK(first->bytes.ends_with("\r\n\r\nstats 1 1"));
+
+    CHECK(respond_to("/stats/1") == first);
+    CHECK(calls == 1);
+
+    // the query is part of the key
+    CHECK(respond_to("/stats/1?full=true") != first);
+    CHECK(calls == 2);
+
+    // errors aren't kept
+    respond_to("/stats/0");
+    respond_to("/stats/0");
+    CHECK(calls == 4);
+}
+
+TEST_CASE("A callback can return a value to be written with glaze", "[response]")
+{
+    using mech_suit::http::verb;
+
+    mech_suit::detail::router router;
+
+    router.add_route<"/foo/:int(a)", verb::get>([](const mech_suit::http_request&, int a) { return foo {a, "got"}; });
+
+    router.add_route<"/foo", verb::post, mech_suit::body_json<foo>>(
+        [](const mech_suit::http_request&, const foo& body)
+        { return mech_suit::json_response<foo> {body, mech_suit::http::status::created}; });
+
+    const auto respond_to = [&](mech_suit::http_request request)
+    {
+        auto response = router.handle_request(request);
+        return mech_suit::detail::serialize(std::get<mech_suit::http::message_generator>(response));
+    };
+
+    const auto got = respond_to(make_request(verb::get, "/foo/7"));
+    CHECK(got.starts_with("HTTP/1.1 200 OK\r\n"));
+    CHECK(got.find("Content-Type: application/json\r\n") != std::string::npos);
+    CHECK(got.find("Content-Length: 17\r\n") != std::string::npos);
+    CHECK(got.ends_with("\r\n\r\n{\"a\":7,\"s\":\"got\"}"));
+
+    auto post = make_request(verb::post, "/foo");
+    post.beast_request.body() = R"({"a":1,"s":"posted"})";
+    CHECK(respond_to(std::move(post)).starts_with("HTTP/1.1 201 Created\r\n"));
+
+    // more responses than the pool holds, and the buffer they were written into still comes back
+    // to it, rather than being crowded out by the empty strings their bodies were moved out of
+    for (int i = 0; i < 200; i++)
+    {
+        respond_to(make_request(verb::get, "/foo/" + std::to_string(i)));
+    }
+
+    auto pooled = mech_suit::detail::string_pool::acquire();
+    CHECK(pooled.capacity() > std::string {}.capacity());
+    mech_suit::detail::string_pool::release(std::move(pooled));
+}
+
+TEST_CASE("The format of a value is chosen from the Accept header", "[response]")
+{
+    using mech_suit::http::verb;
+    using mech_suit::detail::prefers_beve;
+
+    CHECK_FALSE(prefers_beve(""));
+    CHECK_FALSE(prefers_beve("text/html,application/xhtml+xml,*/*;q=0.8"));
+    CHECK_FALSE(prefers_beve("application/json, application/beve"));
+    CHECK_FALSE(prefers_beve("application/beve;q=0.5, application/json"));
+    CHECK(prefers_beve("application/beve"));
+    CHECK(prefers_beve("application/json;q=0.9, application/beve"));
+    CHECK(prefers_beve("Application/BEVE, */*;q=0.1"));
+
+    mech_suit::detail::router router;
+    router.add_route<"/foo", verb::post, mech_suit::body_glz_any<foo>>(
+        [](const mech_suit::http_request&, const foo& body) { return body; });
+
+    const auto content_type = [&](std::string_view accept)
+    {
+        auto request = make_request(verb::post, "/foo");
+        request.beast_request.set(mech_suit::http::field::content_type, "application/json; charset=utf-8");
+        request.beast_request.set(mech_suit::http::field::accept, accept);
+        request.beast_request.body() = R"({"a":1,"s":"posted"})";
+
+        auto response = router.handle_request(request);
+        const auto bytes = mech_suit::detail::serialize(std::get<mech_suit::http::message_generator>(response));
+        CHECK(bytes.find("Vary: Accept\r\n") != std::string::npos);
+
+        const auto begin = bytes.find("Content-Type: ") + 14;
+        return bytes.substr(begin, bytes.find("\r\n", begin) - begin);
+    };
+
+    CHECK(content_type("application/beve") == "application/beve");
+    CHECK(content_type("*/*") == "application/json");
+}
+
+TEST_CASE("Responses are compressed for clients that accept it", "[compression]")
+{
+    using mech_suit::http::verb;
+    namespace zlib = mech_suit::beast::zlib;
+
+    CHECK(mech_suit::detail::crc32("123456789") == 0xCBF43926);
+    CHECK(mech_suit::detail::adler32("Wikipedia") == 0x11E60398);
+    CHECK(mech_suit::detail::crc32("456789", mech_suit::detail::crc32("123")) == 0xCBF43926);
+    CHECK(mech_suit::detail::adler32("pedia", mech_suit::detail::adler32("Wiki")) == 0x11E60398);
+    CHECK(mech_suit::detail::choose_encoding("deflate, gzip;q=0.5") == mech_suit::detail::content_encoding::deflate);
+    CHECK(mech_suit::detail::choose_encoding("br, *") == mech_suit::detail::content_encoding::gzip);
+    CHECK_FALSE(mech_suit::detail::choose_encoding("gzip;q=0, identity"));
+    CHECK(mech_suit::detail::choose_encoding("gzip;q=0, *") == mech_suit::detail::content_encoding::deflate);
+    CHECK_FALSE(mech_suit::detail::choose_encoding("gzip;q=0"));
+
+    std::string text;
+    for (int i = 0; i < 200; i++)
+    {
+        text += "the same few words, over and over again. ";
+    }
+
+    int calls = 0;
+    const auto text_response = [&](const mech_suit::http_request& request)
+    {
+        calls++;
+        mech_suit::http::response<mech_suit::http::string_body> response {mech_suit::http::status::ok,
+                                                                          request.beast_request.version()};
+        response.set(mech_suit::http::field::content_type, "text/plain");
+        response.body() = text;
+        response.prepare_payload();
+        return response;
+    };
+
+    mech_suit::detail::router router;
+    router.add_route<"/text", verb::get>(
+        text_response,
+        mech_suit::route_options {.compression = mech_suit::compression_options {.min_size = 100, .level = 9}});
+    router.add_route<"/cached", verb::get>(
+        text_response,
+        mech_suit::route_options {.cache = mech_suit::cache_options {.ttl = std::chrono::hours(1)},
+                                  .compression = mech_suit::compression_options {.min_size = 100}});
+    router.add_route<"/value", verb::get>(
+        [&](const mech_suit::http_request&) { return foo {1, text}; },
+        mech_suit::route_options {.compression = mech_suit::compression_options {.min_size = 100}});
+
+    // the body is compressed before it is serialized, so a route can't hand over a message_generator
+    CHECK_THROWS_AS((router.add_route<"/erased", verb::get>(
+                        [](const mech_suit::http_request& request) { return respond(request); },
+                        mech_suit::route_options {.compression = mech_suit::compression_options {}})),
+                    std::invalid_argument);
+    CHECK_THROWS_AS((router.add_route<"/level", verb::get>(
+                        text_response,
+                        mech_suit::route_options {.compression = mech_suit::compression_options {.level = 0}})),
+                    std::invalid_argument);
+    CHECK_THROWS_AS((router.add_route<"/level", verb::get>(
+                        text_response,
+                        mech_suit::route_options {.compression = mech_suit::compression_options {.level = 10}})),
+                    std::invalid_argument);
+
+    const auto respond_to = [&](std::string_view accept_encoding, std::string_view target = "/text")
+    {
+        auto request = make_request(verb::get, target);
+        request.beast_request.set(mech_suit::http::field::accept_encoding, accept_encoding);
+
+        auto response = router.handle_request(request);
+        std::string bytes;
+        if (auto* generator = std::get_if<mech_suit::http::message_generator>(&response))
+        {
+            bytes = mech_suit::detail::serialize(*generator);
+        }
+        else
+        {
+            bytes = std::get<std::shared_ptr<const mech_suit::detail::cached_response>>(response)->bytes;
+        }
+
+        mech_suit::http::response_parser<mech_suit::http::string_body> parser;
+        parser.eager(true);
+        mech_suit::beast::error_code err;
+        parser.put(mech_suit::net::buffer(bytes), err);
+        REQUIRE(parser.is_done());
+        return parser.release();
+    };
+
+    const auto plain = respond_to("");
+    CHECK(plain.body() == text);
+    CHECK(plain[mech_suit::http::field::vary] == "Accept-Encoding");
+
+    const auto gzipped = respond_to("gzip");
+    CHECK(gzipped[mech_suit::http::field::content_encoding] == "gzip");
+    REQUIRE(gzipped.body().size() > 18);
+    CHECK(gzipped.body().size() < text.size() / 10);
+
+    // a gzip member is a header, a raw deflate stream, then its CRC and size
+    const auto& body = gzipped.body();
+    std::string inflated(text.size(), '\0');
+    zlib::z_params params {};
+    params.next_in = body.data() + 10;
+    params.avail_in = body.size() - 18;
+    params.next_out = inflated.data();
+    params.avail_out = inflated.size();
+
+    zlib::inflate_stream stream;
+    mech_suit::beast::error_code err;
+    stream.write(params, zlib::Flush::finish, err);
+    CHECK(params.total_out == text.size());
+    CHECK(inflated == text);
+    CHECK(mech_suit::detail::crc32(text) == static_cast<uint32_t>(static_cast<uint8_t>(body[body.size() - 8]))
+              + (static_cast<uint32_t>(static_cast<uint8_t>(body[body.size() - 7])) << 8)
+              + (static_cast<uint32_t>(static_cast<uint8_t>(body[body.size() - 6])) << 16)
+              + (static_cast<uint32_t>(static_cast<uint8_t>(body[body.size() - 5])) << 24));
+
+    // a body written in pieces compresses to one stream
+    std::string pieces;
+    mech_suit::detail::body_compressor compressor {mech_suit::detail::content_encoding::gzip, 1, pieces};
+    compressor.write(std::string_view(text).substr(0, 1000));
+    compressor.write(std::string_view(text).substr(1000));
+    compressor.finish();
+
+    std::string inflated_pieces(text.size(), '\0');
+    zlib::z_params pieces_params {};
+    pieces_params.next_in = pieces.data() + 10;
+    pieces_params.avail_in = pieces.size() - 18;
+    pieces_params.next_out = inflated_pieces.data();
+    pieces_params.avail_out = inflated_pieces.size();
+    zlib::inflate_stream pieces_stream;
+    mech_suit::beast::error_code pieces_err;
+    pieces_stream.write(pieces_params, zlib::Flush::finish, pieces_err);
+    CHECK(inflated_pieces == text);
+    CHECK(pieces.substr(pieces.size() - 8) == body.substr(body.size() - 8));
+
+    const auto deflated = respond_to("deflate", "/value");
+    CHECK(deflated[mech_suit::http::field::content_encoding] == "deflate");
+    CHECK(deflated[mech_suit::http::field::vary] == "Accept, Accept-Encoding");
+    CHECK(deflated.body().starts_with("\x78\x9c"));
+
+    // a cached route keeps a response per encoding, which only a compressed route needs
+    CHECK(respond_to("gzip", "/cached")[mech_suit::http::field::content_encoding] == "gzip");
+    CHECK(respond_to("", "/cached").body() == text);
+    CHECK(respond_to("gzip", "/cached")[mech_suit::http::field::content_encoding] == "gzip");
+    CHECK(calls == 4);
+
+    mech_suit::detail::response_cache cache {mech_suit::cache_options {}};
+    auto request = make_request(verb::get, "/cached");
+    auto other = make_request(verb::get, "/cached");
+    other.beast_request.set(mech_suit::http::field::accept_encoding, "gzip");
+    std::string key;
+    std::string other_key;
+    cache.make_key(request, key);
+    cache.make_key(other, other_key);
+    CHECK(key == other_key);
+}
+
+TEST_CASE("Connections past the limit are turned away until others close", "[listener]")
+{
+    using mech_suit::detail::connection_limit;
+
+    const auto limit = std::make_shared<connection_limit>(2);
+    {
+        auto first = limit->try_acquire();
+        auto second = limit->try_acquire();
+        CHECK(first.has_value());
+        CHECK(second.has_value());
+        CHECK_FALSE(limit->try_acquire().has_value());
+        CHECK(limit->count() == 2);
+
+        first.reset();
+        CHECK(limit->try_acquire().has_value());
+    }
+    CHECK(limit->count() == 0);
+
+    const auto unlimited = std::make_shared<connection_limit>(0);
+    std::vector<connection_limit::slot> slots;
+    for (int i = 0; i < 100; i++)
+    {
+        slots.push_back(std::move(*unlimited->try_acquire()));
+    }
+    CHECK(unlimited->count() == 100);
+
+    CHECK(mech_suit::detail::is_out_of_resources(mech_suit::net::error::no_descriptors));
+    CHECK_FALSE(mech_suit::detail::is_out_of_resources(mech_suit::net::error::connection_aborted));
+}
+
+TEST_CASE("The listeners of a thread per core share their port", "[listener]")
+{
+    using mech_suit::http::verb;
+    using mech_suit::tcp;
+
+    mech_suit::net::io_context ioc;
+
+    // a port that is free, for now
+    const auto address = mech_suit::net::ip::make_address("127.0.0.1");
+    tcp::acceptor probe {ioc, tcp::endpoint {address, 0}};
+    const auto port = probe.local_endpoint().port();
+    probe.close();
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/", verb::get>([](const mech_suit::http_request& request) { return respond(request); });
+
+    const auto listen = [&](bool thread_per_core)
+    {
+        const auto conf = std::make_shared<mech_suit::config>(
+            mech_suit::config {.address = "127.0.0.1", .port = port, .thread_per_core = thread_per_core});
+        return std::make_shared<mech_suit::detail::listener<mech_suit::detail::router>>(
+            conf,
+            ioc,
+            router,
+            [](mech_suit::beast::error_code) {},
+            std::make_shared<mech_suit::detail::connection_limit>(0));
+    };
+
+#if defined(SO_REUSEPORT)
+    const auto first = listen(true);
+    const auto second = listen(true);
+
+    // without SO_REUSEPORT, the port is taken
+    CHECK_THROWS_AS(listen(false), std::runtime_error);
+
+    first->run();
+    second->run();
+
+    // whichever of them the kernel hands the connection to serves it
+    std::string response;
+    std::atomic<bool> done = false;
+    std::thread client(
+        [&]
+        {
+            mech_suit::net::io_context client_ioc;
+            tcp::socket socket {client_ioc};
+            socket.connect(tcp::endpoint {address, port});
+            const std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            mech_suit::net::write(socket, mech_suit::net::buffer(request));
+
+            // `respond` keeps the connection open, so only its headers are waited for
+            mech_suit::beast::error_code err;
+            std::array<char, 1024> buffer {};
+            while (not err && response.find("\r\n\r\n") == std::string::npos)
+            {
+                const auto count = socket.read_some(mech_suit::net::buffer(buffer), err);
+                response.append(buffer.data(), count);
+            }
+            done = true;
+        });
+
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (not done && std::chrono::steady_clock::now() < give_up)
+    {
+        ioc.run_one_for(std::chrono::milliseconds(100));
+    }
+    client.join();
+    CHECK(response.starts_with("HTTP/1.1 200 OK"));
+#else
+    CHECK_THROWS_AS(listen(true), std::runtime_error);
+#endif
+}
+
+namespace
+{
+struct timed : std::enable_shared_from_this<timed>
+{
+    int expired = 0;
+    mech_suit::detail::deadline deadline {[this] { expired++; }};
+};
+}  // namespace
+
+TEST_CASE("Deadlines on a timer wheel expire once, unless moved or cancelled", "[timer_wheel]")
+{
+    using mech_suit::detail::timer_wheel;
+    using namespace std::chrono_literals;
+
+    mech_suit::net::io_context ioc;
+    auto& wheel = mech_suit::detail::timer_wheel_of(ioc.get_executor());
+
+    const auto soon = std::make_shared<timed>();
+    const auto moved = std::make_shared<timed>();
+    const auto cancelled = std::make_shared<timed>();
+    auto gone = std::make_shared<timed>();
+
+    wheel.expires_after(*soon, soon->deadline, 50ms);
+    wheel.expires_after(*moved, moved->deadline, 50ms);
+    wheel.expires_after(*cancelled, cancelled->deadline, 50ms);
+    wheel.expires_after(*gone, gone->deadline, 50ms);
+    CHECK_FALSE(wheel.expired(soon->deadline));
+
+    // later, so it is left where it is on the wheel, and looked at again when that comes round
+    wheel.expires_after(*moved, moved->deadline, 10s);
+    timer_wheel::cancel(cancelled->deadline);
+    gone.reset();
+
+    ioc.run_for(500ms);
+
+    CHECK(soon->expired == 1);
+    CHECK(wheel.expired(soon->deadline));
+    CHECK(moved->expired == 0);
+    CHECK_FALSE(wheel.expired(moved->deadline));
+    CHECK(cancelled->expired == 0);
+}
+
+TEST_CASE("Latencies are counted per route and status, and served as Prometheus text", "[metrics]")
+{
+    using mech_suit::http::verb;
+    using mech_suit::detail::latency_buckets;
+    using namespace std::chrono_literals;
+
+    for (size_t i = 0; i + 1 < latency_buckets::count; i++)
+    {
+        CHECK(latency_buckets::index(latency_buckets::lower_bound(i)) == i);
+        CHECK(latency_buckets::index(latency_buckets::upper_bound(i) - 1) == i);
+    }
+    CHECK(latency_buckets::index(UINT64_MAX) == latency_buckets::count - 1);
+
+    mech_suit::detail::router router;
+    router.add_route<"/users/:int(id)", verb::get>(
+        [](const mech_suit::http_request& /*request*/, int /*id*/) -> mech_suit::http::message_generator
+        { return mech_suit::http::response<mech_suit::http::empty_body> {mech_suit::http::status::ok, 11}; });
+
+    // nothing is counted, or served, until metrics are asked for
+    CHECK(router.get_metrics() == nullptr);
+    CHECK_FALSE(router.find_metrics(make_request(verb::get, "/metrics")).has_value());
+
+    router.serve_metrics("/metrics");
+    router.start_metrics(router.route_labels().size());
+    auto& metrics = *router.get_metrics();
+
+    const auto match = router.find_route(make_request(verb::get, "/users/1"));
+    REQUIRE(match.found());
+    metrics.record(router.route_id(match), 200, 150us);
+    metrics.record(router.route_id(match), 200, 3ms);
+    metrics.record(router.route_id(match), 500, 10us);
+    metrics.record(metrics.route_id(mech_suit::detail::metrics::unmatched_route), 404, 10us);
+    metrics.connection_opened();
+    metrics.connection_opened();
+    metrics.connection_closed();
+    metrics.sent(1234);
+
+    auto response = router.find_metrics(make_request(verb::get, "/metrics"));
+    REQUIRE(response.has_value());
+    const auto text = mech_suit::detail::serialize(*response);
+
+    const auto has = [&](std::string_view line) { return text.find(line) != std::string::npos; };
+    CHECK(has("# TYPE mech_suit_request_duration_seconds histogram\n"));
+    CHECK(has("mech_suit_request_duration_seconds_count{method=\"GET\",route=\"/users/:int(id)\",status=\"200\"} 2\n"));
+    CHECK(has("mech_suit_request_duration_seconds_count{method=\"GET\",route=\"/users/:int(id)\",status=\"500\"} 1\n"));
+    CHECK(has("mech_suit_request_duration_seconds_bucket{method=\"GET\",route=\"/users/:int(id)\",status=\"200\","
+              "le=\"0.000160\"} 1\n"));
+    CHECK(has("mech_suit_request_duration_seconds_sum{method=\"GET\",route=\"/users/:int(id)\",status=\"200\"} "
+              "0.003150\n"));
+    CHECK(has("mech_suit_request_duration_seconds_count{method=\"\",route=\"\",status=\"404\"} 1\n"));
+    CHECK(has("mech_suit_connections 1\n"));
+    CHECK(has("mech_suit_connections_total 2\n"));
+    CHECK(has("mech_suit_sent_bytes_total 1234\n"));
+    CHECK_FALSE(has("status=\"other\""));
+
+    // past a route's first 8 statuses, the rest are counted together rather than under the 8th
+    for (unsigned status = 201; status <= 210; status++)
+    {
+        metrics.record(router.route_id(match), status, 10us);
+    }
+    auto more = router.find_metrics(make_request(verb::get, "/metrics"));
+    REQUIRE(more.has_value());
+    const auto more_text = mech_suit::detail::serialize(*more);
+    const auto more_has = [&](std::string_view line) { return more_text.find(line) != std::string::npos; };
+    CHECK(more_has("mech_suit_request_duration_seconds_count{method=\"GET\",route=\"/users/:int(id)\","
+                   "status=\"206\"} 1\n"));
+    CHECK_FALSE(more_has("status=\"207\""));
+    CHECK(more_has("mech_suit_request_duration_seconds_count{method=\"GET\",route=\"/users/:int(id)\","
+                   "status=\"other\"} 4\n"));
+}
+
+TEST_CASE("The slowest traced requests are dumped with the time spent in each stage", "[tracing]")
+{
+    using mech_suit::http::verb;
+    using mech_suit::detail::request_trace;
+
+    mech_suit::detail::router router;
+    router.add_route<"/items", verb::post, mech_suit::body_json<foo>>(
+        [](const mech_suit::http_request& request, const foo& /*body*/) -> mech_suit::http::message_generator
+        { return respond(request); });
+
+    // nothing is traced, or served, until traces are asked for
+    CHECK(router.get_tracer() == nullptr);
+    CHECK_FALSE(router.find_traces(make_request(verb::get, "/traces")).has_value());
+
+    router.serve_traces("/traces", 2);
+    router.start_metrics(router.route_labels().size());
+    auto& tracer = *router.get_tracer();
+
+    // the route marks when it is done parsing the body
+    request_trace parsed;
+    auto request = make_request(verb::post, "/items");
+    request.beast_request.body() = "{}";
+    request.trace = &parsed;
+    router.handle_request(request);
+    CHECK(parsed.at[request_trace::body_parsed] != 0);
+
+    const auto trace = [](int64_t headers, int64_t handled, int64_t written)
+    {
+        request_trace result;
+        result.at[request_trace::started] = 1000;
+        result.at[request_trace::headers_read] = 1000 + headers;
+        result.at[request_trace::handled] = result.at[request_trace::headers_read] + handled;
+        result.at[request_trace::write_started] = result.at[request_trace::handled];
+        result.at[request_trace::written] = result.at[request_trace::write_started] + written;
+        return result;
+    };
+
+    const auto route = router.route_id(router.find_route(make_request(verb::post, "/items")));
+    tracer.record(route, 200, trace(1000, 5000, 2000));
+    tracer.record(route, 200, trace(1000, 1000, 1000));
+    tracer.record(route, 500, trace(1000, 50000, 1000));
+
+    // only the last two still fit in the ring of this thread
+    auto slowest = tracer.slowest(5);
+    REQUIRE(slowest.size() == 2);
+    CHECK(slowest[0].status == 500);
+    CHECK(slowest[0].trace.duration() == 52000);
+    CHECK(slowest[0].trace.duration(request_trace::handled) == 50000);
+    CHECK(slowest[0].trace.duration(request_trace::body_read) == 0);
+    CHECK(slowest[1].trace.duration() == 3000);
+
+    auto response = router.find_traces(make_request(verb::get, "/traces?slowest=1"));
+    REQUIRE(response.has_value());
+    const auto text = mech_suit::detail::serialize(*response);
+    CHECK(text.find("total accept headers body_read body_parse handler queued write thread status method route\n")
+          != std::string::npos);
+    CHECK(text.find("52.000 0.000 1.000 0.000 0.000 50.000 0.000 1.000 0 500 POST /items\n") != std::string::npos);
+    CHECK(text.find(" 200 POST") == std::string::npos);
+
+    response = router.find_traces(make_request(verb::get, "/traces?format=chrome"));
+    REQUIRE(response.has_value());
+    const auto json = mech_suit::detail::serialize(*response);
+    CHECK(json.find("Content-Type: application/json") != std::string::npos);
+    CHECK(json.find(R"({"name":"handler","ph":"X","pid":1,"tid":0,"ts":1.000,"dur":50.000})") != std::string::npos);
+    CHECK(json.find(R"("args":{"name":"POST /items 200"})") != std::string::npos);
+}
+
+namespace
+{
+// A stream in memory whose writes take `delay` to complete, as they would to a slow client
+class slow_stream
+{
+    mech_suit::memory_stream m_stream;
+    std::chrono::milliseconds m_delay;
+
+  public:
+    using executor_type = mech_suit::memory_stream::executor_type;
+
+    slow_stream(mech_suit::memory_stream stream, std::chrono::milliseconds delay)
+        : m_stream(std::move(stream))
+        , m_delay(delay)
+    {
+    }
+
+    [[nodiscard]] auto get_executor() const -> executor_type { return m_stream.get_executor(); }
+
+    template<typename Buffers, typename Handler>
+    void async_read_some(const Buffers& buffers, Handler&& handler)
+    {
+        m_stream.async_read_some(buffers, std::forward<Handler>(handler));
+    }
+
+    template<typename Buffers, typename Handler>
+    void async_write_some(const Buffers& buffers, Handler&& handler)
+    {
+        auto timer = std::make_shared<mech_suit::net::steady_timer>(get_executor(), m_delay);
+        m_stream.async_write_some(
+            buffers,
+            [timer, handler = std::forward<Handler>(handler)](mech_suit::beast::error_code err, size_t bytes) mutable
+            {
+                timer->async_wait([timer, handler = std::move(handler), err, bytes](mech_suit::beast::error_code) mutable
+                                  { handler(err, bytes); });
+            });
+    }
+
+    void close() { m_stream.close(); }
+};
+
+// A stream in memory whose reads return at most `limit` bytes, as if what was written
+// arrived in that many bytes at a time
+class trickle_stream
+{
+    mech_suit::memory_stream m_stream;
+    size_t m_limit;
+
+  public:
+    using executor_type = mech_suit::memory_stream::executor_type;
+
+    trickle_stream(mech_suit::memory_stream stream, size_t limit)
+        : m_stream(std::move(stream))
+        , m_limit(limit)
+    {
+    }
+
+    [[nodiscard]] auto get_executor() const -> executor_type { return m_stream.get_executor(); }
+
+    template<typename Buffers, typename Handler>
+    void async_read_some(const Buffers& buffers, Handler&& handler)
+    {
+        m_stream.async_read_some(mech_suit::beast::buffers_prefix(m_limit, buffers), std::forward<Handler>(handler));
+    }
+
+    template<typename Buffers, typename Handler>
+    void async_write_some(const Buffers& buffers, Handler&& handler)
+    {
+        m_stream.async_write_some(buffers, std::forward<Handler>(handler));
+    }
+
+    void close() { m_stream.close(); }
+};
+
+// Write `requests` to a session over a stream in memory, and read everything it
+// writes back until it closes the connection. The session's end is made into a
+// `Stream` with `args`
+template<typename Stream = mech_suit::memory_stream, typename... Args>
+auto serve_in_memory(std::shared_ptr<const mech_suit::detail::router> router,
+                     mech_suit::config conf,
+                     const std::string& requests,
+                     Args... args) -> std::string
+{
+    using namespace std::chrono_literals;
+
+    mech_suit::net::io_context ioc;
+    auto [client, server] = mech_suit::memory_stream::pair(ioc.get_executor());
+
+    std::make_shared<mech_suit::detail::http_session<mech_suit::detail::router, Stream>>(
+        std::make_shared<mech_suit::config>(std::move(conf)),
+        Stream {std::move(server), args...},
+        std::move(router),
+        [](mech_suit::beast::error_code) {})
+        ->run();
+
+    mech_suit::net::async_write(
+        client, mech_suit::net::buffer(requests), [](mech_suit::beast::error_code, size_t) {});
+
+    std::string received;
+    std::array<char, 64> chunk {};
+    mech_suit::beast::error_code read_error;
+    bool closed = false;
+
+    std::function<void(mech_suit::beast::error_code, size_t)> on_read =
+        [&](mech_suit::beast::error_code err, size_t bytes)
+    {
+        received.append(chunk.data(), bytes);
+        if (err)
+        {
+            read_error = err;
+            closed = true;
+            return;
+        }
+        client.async_read_some(mech_suit::net::buffer(chunk), on_read);
+    };
+    client.async_read_some(mech_suit::net::buffer(chunk), on_read);
+
+    // not `run()`, as the timer wheel keeps ticking
+    const auto until = std::chrono::steady_clock::now() + 5s;
+    while (not closed && std::chrono::steady_clock::now() < until)
+    {
+        ioc.run_one_for(100ms);
+    }
+
+    REQUIRE(closed);
+    CHECK(read_error == mech_suit::net::error::eof);
+    return received;
+}
+}  // namespace
+
+TEST_CASE("A session serves raw requests written to a stream in memory", "[memory_stream]")
+{
+    using mech_suit::http::verb;
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/users/:int(id)", verb::get>(
+        [](const mech_suit::http_request& /*request*/, int id) { return foo {id, "user"}; });
+    router->add_route<"/echo", verb::post, mech_suit::body_string>(
+        [](const mech_suit::http_request& request, std::string_view body) -> mech_suit::http::message_generator
+        {
+            mech_suit::http::response<mech_suit::http::string_body> response {mech_suit::http::status::ok,
+                                                                              request.beast_request.version()};
+            response.keep_alive(request.beast_request.keep_alive());
+            response.body() = body;
+            response.prepare_payload();
+            return response;
+        });
+
+    // pipelined, and the last one closes the connection
+    const auto received = serve_in_memory(router,
+                                          {},
+                                          "GET /users/7 HTTP/1.1\r\n\r\n"
+                                          "POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+                                          "GET /users/8 HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+    const auto first = received.find(R"({"a":7,"s":"user"})");
+    const auto echoed = received.find("\r\n\r\nhello");
+    const auto last = received.find(R"({"a":8,"s":"user"})");
+    CHECK(first != std::string::npos);
+    CHECK(echoed != std::string::npos);
+    CHECK(last != std::string::npos);
+    CHECK(first < echoed);
+    CHECK(echoed < last);
+    CHECK(received.ends_with(R"({"a":8,"s":"user"})"));
+}
+
+TEST_CASE("A body of known length is read straight into its request", "[session]")
+{
+    using mech_suit::http::verb;
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/users/:int(id)", verb::get>(
+        [](const mech_suit::http_request& /*request*/, int id) { return foo {id, "user"}; });
+    router->add_route<"/echo", verb::post, mech_suit::body_string>(
+        [](const mech_suit::http_request& request, std::string_view body) -> mech_suit::http::message_generator
+        {
+            mech_suit::http::response<mech_suit::http::string_body> response {mech_suit::http::status::ok,
+                                                                              request.beast_request.version()};
+            response.keep_alive(request.beast_request.keep_alive());
+            response.body() = body;
+            response.prepare_payload();
+            return response;
+        });
+
+    const auto post = [](const std::string& body)
+    { return "POST /echo HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body; };
+
+    std::string body;
+    for (int i = 0; i < 2000; i++)
+    {
+        body += std::to_string(i) + ',';
+    }
+
+    // the rest of the body arrives in many reads after the part read along with the headers
+    auto received = serve_in_memory<trickle_stream>(
+        router, {}, post(body) + "GET /users/1 HTTP/1.1\r\nConnection: close\r\n\r\n", size_t {100});
+    auto echoed = received.find("\r\n\r\n" + body + "HTTP/1.1 200");
+    CHECK(echoed != std::string::npos);
+    CHECK(received.ends_with(R"({"a":1,"s":"user"})"));
+
+    // a request pipelined right behind a body much bigger than the first read is read
+    // from where the body ends
+    received = serve_in_memory(router,
+                               {},
+                               post(body) + "GET /users/2 HTTP/1.1\r\n\r\n" + post("short")
+                                   + "GET /users/3 HTTP/1.1\r\nConnection: close\r\n\r\n");
+    echoed = received.find("\r\n\r\n" + body + "HTTP/1.1 200");
+    const auto second = received.find(R"({"a":2,"s":"user"})");
+    const auto short_echoed = received.find("\r\n\r\nshortHTTP/1.1 200");
+    CHECK(echoed != std::string::npos);
+    CHECK(second != std::string::npos);
+    CHECK(short_echoed != std::string::npos);
+    CHECK(echoed < second);
+    CHECK(second < short_echoed);
+    CHECK(received.ends_with(R"({"a":3,"s":"user"})"));
+
+    // a body declared over the limit is refused before any of it is read
+    mech_suit::config conf;
+    conf.max_body_size = 1000;
+    received = serve_in_memory(router, conf, post(body) + "GET /users/4 HTTP/1.1\r\n\r\n");
+    CHECK(received.starts_with("HTTP/1.1 413"));
+    CHECK(received.find("HTTP/1.1", 1) == std::string::npos);
+
+    received = serve_in_memory(
+        router, conf, post(std::string(1000, 'a')) + "GET /users/5 HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(received.find("\r\n\r\n" + std::string(1000, 'a') + "HTTP/1.1 200") != std::string::npos);
+    CHECK(received.ends_with(R"({"a":5,"s":"user"})"));
+}
+
+TEST_CASE("Pipelined requests are read again as soon as their queue has room", "[session]")
+{
+    using mech_suit::http::verb;
+    using mech_suit::detail::request_trace;
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/users/:int(id)", verb::get>(
+        [](const mech_suit::http_request& /*request*/, int id) { return foo {id, "user"}; });
+    router->serve_traces("/traces");
+    router->start_metrics(router->route_labels().size());
+
+    std::string requests;
+    for (int id = 1; id <= 5; id++)
+    {
+        requests += "GET /users/" + std::to_string(id) + " HTTP/1.1\r\n";
+        requests += id == 5 ? "Connection: close\r\n\r\n" : "\r\n";
+    }
+
+    // the responses are written slower than the requests are read, so the queue fills up
+    mech_suit::config conf;
+    conf.pipeline_depth = 2;
+    const auto received = serve_in_memory<slow_stream>(router, conf, requests, std::chrono::milliseconds(5));
+
+    // every response, in order
+    size_t from = 0;
+    for (int id = 1; id <= 5; id++)
+    {
+        const auto body = R"({"a":)" + std::to_string(id) + R"(,"s":"user"})";
+        const auto at = received.find(body, from);
+        REQUIRE(at != std::string::npos);
+        from = at + body.size();
+    }
+
+    auto traced = router->get_tracer()->slowest(5);
+    REQUIRE(traced.size() == 5);
+    std::sort(traced.begin(),
+              traced.end(),
+              [](const auto& lhs, const auto& rhs)
+              { return lhs.trace.at[request_trace::started] < rhs.trace.at[request_trace::started]; });
+
+    // with two queued, the third is read once the first has been written rather than both
+    CHECK(traced[2].trace.at[request_trace::started] > traced[0].trace.at[request_trace::written]);
+    CHECK(traced[2].trace.at[request_trace::started] < traced[1].trace.at[request_trace::written]);
+}
+
+TEST_CASE("A body in a format its route doesn't read is rejected from the headers", "[session]")
+{
+    using mech_suit::http::verb;
+
+    int called = 0;
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/json", verb::post, mech_suit::body_json<foo>>(
+        [&](const mech_suit::http_request& /*request*/, const foo& body)
+        {
+            called++;
+            return body;
+        });
+    router->add_route<"/any", verb::post, mech_suit::body_glz_any<foo>>(
+        [&](const mech_suit::http_request& /*request*/, const foo& body)
+        {
+            called++;
+            return body;
+        });
+
+    const auto post = [](std::string_view path, std::string_view content_type)
+    {
+        const std::string body = R"({"a":1,"s":"x"})";
+        std::string request = "POST " + std::string(path) + " HTTP/1.1\r\nContent-Length: "
+            + std::to_string(body.size()) + "\r\n";
+        if (not content_type.empty())
+        {
+            request += "Content-Type: " + std::string(content_type) + "\r\n";
+        }
+        return request + "\r\n" + body;
+    };
+
+    auto received = serve_in_memory(router,
+                                    {},
+                                    post("/json", "application/json; charset=utf-8") + post("/json", "")
+                                        + post("/json", "application/merge-patch+json") + post("/any", "application/json")
+                                        + "GET /json HTTP/1.1\r\nConnection: close\r\n\r\n");
+    CHECK(called == 4);
+    CHECK(received.find("415") == std::string::npos);
+
+    received = serve_in_memory(router, {}, post("/json", "text/plain") + post("/json", "application/json"));
+    CHECK(received.starts_with("HTTP/1.1 415 Unsupported Media Type\r\n"));
+    CHECK(received.find("Connection: close") != std::string::npos);
+    CHECK(received.find("HTTP/1.1", 1) == std::string::npos);
+    CHECK(called == 4);
+
+    received = serve_in_memory(router, {}, post("/any", "application/xml"));
+    CHECK(received.starts_with("HTTP/1.1 415"));
+    CHECK(called == 4);
+}
+
+TEST_CASE("Whatever a coroutine route throws only fails its own connection", "[session]")
+{
+    using mech_suit::http::verb;
+    using response_t = mech_suit::net::awaitable<mech_suit::http::message_generator>;
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_route<"/int", verb::get>(
+        [](const mech_suit::http_request& /*request*/) -> response_t
+        {
+            throw 42;
+            co_return mech_suit::http::response<mech_suit::http::empty_body> {};
+        });
+    router->add_route<"/error", verb::get>(
+        [](const mech_suit::http_request& /*request*/) -> response_t
+        {
+            throw std::runtime_error("route failed");
+            co_return mech_suit::http::response<mech_suit::http::empty_body> {};
+        });
+
+    // answered by the exception handler, even though it isn't a std::exception
+    auto received = serve_in_memory(router, {}, "GET /int HTTP/1.1\r\n\r\n");
+    CHECK(received.starts_with("HTTP/1.1 500"));
+    CHECK(received.ends_with("Unknown exception"));
+
+    received = serve_in_memory(router, {}, "GET /error HTTP/1.1\r\n\r\n");
+    CHECK(received.ends_with("route failed"));
+
+    // without a response to write, the connection is closed
+    router->add_exception_handler(
+        [](const mech_suit::http_request& /*request*/,
+           std::exception const& /*except*/) -> mech_suit::http::message_generator
+        { throw std::logic_error("handler failed"); });
+    received = serve_in_memory(router, {}, "GET /error HTTP/1.1\r\n\r\n");
+    CHECK(received.empty());
+}
+
+TEST_CASE("A static file is copied a chunk at a time to a stream that isn't a socket", "[static_files]")
+{
+    const auto root = std::filesystem::temp_directory_path() / "mech_suit_static_copy_test";
+    std::filesystem::create_directories(root);
+
+    std::string content;
+    for (int i = 0; i < 1000; i++)
+    {
+        content += std::to_string(i) + '\n';
+    }
+    std::ofstream(root / "numbers.txt") << content;
+
+    auto router = std::make_shared<mech_suit::detail::router>();
+    router->add_static_files("/files", root);
+
+    mech_suit::config conf;
+    conf.stream_chunk_size = 1000;
+    const auto received =
+        serve_in_memory(router, conf, "GET /files/numbers.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+    CHECK(received.starts_with("HTTP/1.1 200 OK\r\n"));
+    CHECK(received.find("Content-Length: " + std::to_string(content.size())) != std::string::npos);
+    CHECK(received.ends_with("\r\n\r\n" + content));
+
+    std::filesystem::remove_all(root);
+}